@@ -0,0 +1,59 @@
+//
+//  S3BandwidthLimiter.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 24/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3TransferEngine;
+
+#define S3DH_BANDWIDTH_UNLIMITED    0.0     // Rate that turns the limiter off, reservations are granted at once.
+#define S3DH_BANDWIDTH_BURST        1048576 // Bytes that can be reserved at once after the limiter has been idle.
+
+/** Token bucket that caps the bandwidth used by every S3RequestHelper of an S3SyncHelper. The bucket fills
+    at rate bytes per second up to burst bytes, and a helper reserves the length of each range request
+    from it before the request is issued. A reservation larger than the burst is granted once the bucket
+    is full and leaves it in debt, so long runs of large blocks still average out at the rate. Waiting
+    reservations are granted in the order they were made. Callers that set a rate should keep their
+    requests within the burst, so a single request never takes the bucket into debt.
+
+    A reservation that is no longer needed is cancelled with the handle it was made with: one still
+    waiting is dropped without being granted, and one already granted gives back the bytes it did not use.
+
+    The rate and burst may be changed from any thread while transfers are running, the change is applied
+    on the engine thread and the waiting reservations are rescheduled for the new rate. All other methods
+    must be called on the engine thread, completions are called on the engine thread.
+ */
+@interface S3BandwidthReservation : NSObject
+
+@property (nonatomic, readonly) int64_t         bytes;              // Bytes reserved.
+@property (nonatomic, readonly) BOOL            isGranted;          // True once the bytes have been taken from the bucket.
+
+@end
+
+@interface S3BandwidthLimiter : NSObject
+
+- (id)initWithRate:(double)rate burst:(int64_t)burst engine:(S3TransferEngine*)engine;
+
+/** Reserves bytes from the bucket, the completion is called immediately if the bucket holds enough
+    tokens, otherwise once it has refilled and every earlier reservation has been granted. Returns the
+    handle used to cancel the reservation.
+ */
+- (S3BandwidthReservation*)reserveBytes:(int64_t)bytes completion:(void (^)(void))completion;
+
+/** Cancels a reservation. A waiting reservation is dropped and its completion never called, a granted one
+    returns the bytes beyond usedBytes to the bucket. Cancelling a reservation twice does nothing.
+ */
+- (void)cancelReservation:(S3BandwidthReservation*)reservation usedBytes:(int64_t)usedBytes;
+
+@property (nonatomic, assign)   double          rate;               // Bytes per second, S3DH_BANDWIDTH_UNLIMITED for no limit.
+@property (nonatomic, assign)   int64_t         burst;              // Most bytes the bucket can hold.
+@property (nonatomic, readonly) NSUInteger      waitingCount;       // Reservations waiting for tokens.
+@property (nonatomic, readonly) int64_t         bytesReserved;      // Bytes granted since the limiter was created.
+@property (nonatomic, readonly) NSUInteger      waits;              // Reservations that had to wait for tokens.
+@property (nonatomic, readonly) NSTimeInterval  totalWait;          // Seconds reservations spent waiting, summed.
+
+@end
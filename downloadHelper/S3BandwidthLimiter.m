@@ -0,0 +1,225 @@
+//
+//  S3BandwidthLimiter.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 24/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BandwidthLimiter.h"
+#import "S3TransferEngine.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// S3BandwidthReservation
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BandwidthReservation ()
+{
+@public
+    int64_t                 _bytes;                     // Bytes reserved.
+    BOOL                    _isGranted;                 // True once the bytes have been taken from the bucket.
+    BOOL                    _isCancelled;               // True once cancelled, nothing more is taken or refunded.
+    void                    (^_completion)(void);       // Called when granted, released once called or cancelled.
+    NSTimeInterval          _queued;                    // Reference time the reservation started waiting.
+}
+@end
+
+@implementation S3BandwidthReservation
+
+@synthesize bytes           = _bytes;
+@synthesize isGranted       = _isGranted;
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BandwidthLimiter ()
+{
+    double                  _rate;                      // Bytes per second, S3DH_BANDWIDTH_UNLIMITED for no limit.
+    int64_t                 _burst;                     // Most bytes the bucket can hold.
+    S3TransferEngine        *_engine;                   // Engine the waiting reservations are woken on.
+
+    double                  _tokens;                    // Bytes in the bucket at the last refill, negative when in debt.
+    NSTimeInterval          _lastRefill;                // Reference time the bucket was last refilled.
+    NSMutableArray          *_waiting;                  // Pending reservations in the order they were made.
+    NSUInteger              _wakeGeneration;            // Incremented per scheduled wake so that superseded wakes do nothing.
+
+    int64_t                 _bytesReserved;             // Bytes granted since the limiter was created.
+    NSUInteger              _waits;                     // Reservations that had to wait for tokens.
+    NSTimeInterval          _totalWait;                 // Seconds reservations spent waiting, summed.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3BandwidthLimiter
+
+@synthesize bytesReserved   = _bytesReserved;
+@synthesize waits           = _waits;
+@synthesize totalWait       = _totalWait;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithRate:(double)rate burst:(int64_t)burst engine:(S3TransferEngine*)engine
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _engine = engine ) ) return nil;
+
+        _rate       = MAX( rate, 0.0 );
+        _burst      = MAX( burst, 1 );
+        _tokens     = _burst;
+        _lastRefill = [NSDate timeIntervalSinceReferenceDate];
+        _waiting    = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (S3BandwidthReservation*)reserveBytes:(int64_t)bytes completion:(void (^)(void))completion
+{
+    S3BandwidthReservation *reservation = [[S3BandwidthReservation alloc] init];
+    reservation->_bytes = MAX( bytes, 0 );
+    [self refill];
+
+    // Granted straight away if nothing is queued ahead and the bucket covers it, otherwise it waits its turn.
+    if ( [_waiting count] == 0 && [self coversBytes: reservation->_bytes ] ){
+        [self takeBytes: reservation->_bytes ];
+        reservation->_isGranted = true;
+        completion();
+        return reservation;
+    }
+    reservation->_completion    = [completion copy];
+    reservation->_queued        = _lastRefill;
+    [_waiting addObject: reservation ];
+    if ( [_waiting count] == 1 ) [self grantReservations];
+    return reservation;
+}
+
+- (void)cancelReservation:(S3BandwidthReservation*)reservation usedBytes:(int64_t)usedBytes
+{
+    if ( ! reservation || reservation->_isCancelled ) return;
+    reservation->_isCancelled = true;
+
+    // A waiting reservation leaves the queue, the one behind it may now be covered.
+    if ( ! reservation->_isGranted ){
+        NSUInteger index = [_waiting indexOfObjectIdenticalTo: reservation ];
+        reservation->_completion = nil;
+        if ( index == NSNotFound ) return;
+        [_waiting removeObjectAtIndex: index ];
+        if ( index == 0 ) [self grantReservations];
+        return;
+    }
+
+    // A granted reservation returns what it did not use, the bucket never holds more than the burst.
+    int64_t unused = reservation->_bytes - MIN( MAX( usedBytes, 0 ), reservation->_bytes );
+    if ( unused == 0 ) return;
+    [self refill];
+    if ( _rate > 0 ) _tokens = MIN( (double)_burst, _tokens + unused );
+    _bytesReserved -= unused;
+    if ( [_waiting count] > 0 ) [self grantReservations];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)waitingCount  { return [_waiting count];  }
+
+- (double)rate
+{
+    return _rate;
+}
+
+- (void)setRate:(double)rate
+{
+    if ( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self setRate: rate ]; } ];
+        return;
+    }
+    [self refill];                                          // Bank the tokens earned at the old rate first.
+    _rate = MAX( rate, 0.0 );
+    [self grantReservations];
+}
+
+- (int64_t)burst
+{
+    return _burst;
+}
+
+- (void)setBurst:(int64_t)burst
+{
+    if ( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self setBurst: burst ]; } ];
+        return;
+    }
+    [self refill];
+    _burst  = MAX( burst, 1 );
+    _tokens = MIN( _tokens, (double)_burst );
+    [self grantReservations];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Adds the tokens earned since the last refill, an unlimited bucket is always full.
+- (void)refill
+{
+    NSTimeInterval now  = [NSDate timeIntervalSinceReferenceDate];
+    _tokens             = ( _rate > 0 ) ? MIN( (double)_burst, _tokens + ( now - _lastRefill ) * _rate ) : _burst;
+    _lastRefill         = now;
+}
+
+// A reservation larger than the burst only needs a full bucket, the remainder is taken as debt.
+- (BOOL)coversBytes:(int64_t)bytes
+{
+    return _rate <= 0 || _tokens >= MIN( (double)bytes, (double)_burst );
+}
+
+- (void)takeBytes:(int64_t)bytes
+{
+    if ( _rate > 0 ) _tokens -= bytes;
+    _bytesReserved += bytes;
+}
+
+// Grants waiting reservations in order while the bucket covers them, then schedules a wake for when the next one will be
+// covered.
+- (void)grantReservations
+{
+    [self refill];
+
+    while ( [_waiting count] > 0 ) {
+        S3BandwidthReservation *reservation = [_waiting objectAtIndex: 0 ];
+        int64_t bytes   = reservation->_bytes;
+
+        if ( ! [self coversBytes: bytes ] ){
+            NSTimeInterval delay = ( MIN( (double)bytes, (double)_burst ) - _tokens ) / _rate;
+            NSUInteger generation = ++_wakeGeneration;
+            __weak S3BandwidthLimiter *weakSelf = self;
+            [_engine performBlock:^{ [weakSelf wakeForGeneration: generation ]; } afterDelay: delay ];
+            return;
+        }
+        [_waiting removeObjectAtIndex: 0 ];
+        [self takeBytes: bytes ];
+        reservation->_isGranted = true;
+
+        _waits ++;
+        _totalWait += _lastRefill - reservation->_queued;
+
+        void (^completion)(void) = reservation->_completion;
+        reservation->_completion = nil;
+        completion();
+    }
+}
+
+// Only the most recently scheduled wake grants reservations, earlier ones were scheduled for a rate or burst since changed.
+- (void)wakeForGeneration:(NSUInteger)generation
+{
+    if ( generation == _wakeGeneration ) [self grantReservations];
+}
+
+@end
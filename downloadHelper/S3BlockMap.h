@@ -0,0 +1,79 @@
+//
+//  S3BlockMap.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/** Bitmap of the fixed size blocks that make up a single S3 object, used by the S3RequestHelper to
+    track which byte ranges have been requested and which have been completely written to the
+    download file. Blocks are addressed by index, block i covers bytes [i * blockSize, (i+1) * blockSize)
+    with the final block truncated to the object length. Byte offsets are 64 bit so objects larger than
+    4 GB can be mapped on 32 bit devices.
+ */
+@interface S3BlockMap : NSObject
+
+///-------------------------------------------------------------------------------------------------
+/// @name Initialisation Methods
+///-------------------------------------------------------------------------------------------------
+
+- (id)initWithLength:(int64_t)length blockSize:(NSUInteger)blockSize;
+
+/** Recreates a block map saved with completedBitmap, every block set in the bitmap is marked completed.
+    Returns nil if the bitmap does not match the length and block size.
+ */
+- (id)initWithLength:(int64_t)length blockSize:(NSUInteger)blockSize completedBitmap:(NSData*)bitmap;
+
+/** Packed copy of the completed bitmap, used to checkpoint a download so that it can be resumed.
+ */
+- (NSData*)completedBitmap;
+
+///-------------------------------------------------------------------------------------------------
+/// @name Block Control Methods
+///-------------------------------------------------------------------------------------------------
+
+/** Claims up to maxBlocks contiguous blocks starting at the first block that is neither requested
+    nor completed, and marks them requested. Returns a range with location NSNotFound if every block
+    has already been requested or completed.
+ */
+- (NSRange)requestBlocks:(NSUInteger)maxBlocks;
+
+/** Marks a range of blocks as written to file, the blocks are no longer considered requested.
+ */
+- (void)completeBlocks:(NSRange)blocks;
+
+/** Returns a range of requested blocks to the pool, used when a block request fails or is cancelled
+    so that the range will be requested again.
+ */
+- (void)releaseBlocks:(NSRange)blocks;
+
+/** Number of blocks from the start of the object that have all been completed, blocks completed out of
+    order are only counted once every block before them has completed.
+ */
+- (NSUInteger)committedBlocks;
+
+/** Byte offset of the first byte of the specified block.
+ */
+- (int64_t)offsetOfBlock:(NSUInteger)index;
+
+/** Number of bytes covered by a range of blocks, taking account of the truncated final block.
+ */
+- (int64_t)lengthOfBlocks:(NSRange)blocks;
+
+///-------------------------------------------------------------------------------------------------
+/// @name Properties
+///-------------------------------------------------------------------------------------------------
+
+@property (nonatomic, readonly) int64_t     length;             // Object length in bytes.
+@property (nonatomic, readonly) NSUInteger  blockSize;          // Size of each block in bytes.
+@property (nonatomic, readonly) NSUInteger  blockCount;         // Number of blocks in the object.
+@property (nonatomic, readonly) NSUInteger  completedBlocks;    // Number of blocks written to file.
+@property (nonatomic, readonly) NSUInteger  unrequestedBlocks;  // Number of blocks neither requested nor written.
+@property (nonatomic, readonly) int64_t     completedLength;    // Number of bytes written to file.
+@property (nonatomic, readonly) int64_t     committedLength;    // Number of contiguous bytes written from the start of file.
+@property (nonatomic, readonly) BOOL        isComplete;         // True when every block has been written.
+
+@end
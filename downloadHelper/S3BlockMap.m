@@ -0,0 +1,219 @@
+//
+//  S3BlockMap.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BlockMap.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BlockMap ()
+{
+    int64_t                 _length;                    // Object length in bytes.
+    NSUInteger              _blockSize;                 // Size of each block in bytes.
+    NSUInteger              _blockCount;                // Number of blocks required to cover the object.
+    NSUInteger              _completedBlocks;           // Count of set bits in the completed bitmap.
+    NSUInteger              _requestedBlocks;           // Count of set bits in the requested bitmap.
+    NSUInteger              _committedBlocks;           // Number of leading blocks that are all completed.
+    NSUInteger              _freeCursor;                // No block before this index is free to request.
+
+    CFMutableBitVectorRef   _requested;                 // Bit set when a block has an active request.
+    CFMutableBitVectorRef   _completed;                 // Bit set when a block has been written to file.
+    CFMutableBitVectorRef   _claimed;                   // Bit set when a block is requested or completed.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3BlockMap
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Synthesized Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+@synthesize length          = _length;
+@synthesize blockSize       = _blockSize;
+@synthesize blockCount      = _blockCount;
+@synthesize completedBlocks = _completedBlocks;
+@synthesize committedBlocks = _committedBlocks;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithLength:(int64_t)length blockSize:(NSUInteger)blockSize
+{
+    self = [super init];
+    if( self ){
+
+        if ( blockSize == 0 || length < 0 ) return nil;
+
+        _length             = length;
+        _blockSize          = blockSize;
+        _blockCount         = (NSUInteger)( ( length + (int64_t)blockSize - 1 ) / (int64_t)blockSize );
+        _completedBlocks    = 0;
+        _requestedBlocks    = 0;
+        _committedBlocks    = 0;
+        _freeCursor         = 0;
+
+        _requested          = CFBitVectorCreateMutable( kCFAllocatorDefault, _blockCount );
+        _completed          = CFBitVectorCreateMutable( kCFAllocatorDefault, _blockCount );
+        _claimed            = CFBitVectorCreateMutable( kCFAllocatorDefault, _blockCount );
+        CFBitVectorSetCount( _requested, _blockCount );
+        CFBitVectorSetCount( _completed, _blockCount );
+        CFBitVectorSetCount( _claimed, _blockCount );
+    }
+    return self;
+}
+
+- (id)initWithLength:(int64_t)length blockSize:(NSUInteger)blockSize completedBitmap:(NSData*)bitmap
+{
+    self = [self initWithLength: length blockSize: blockSize ];
+    if( self ){
+        if ( [bitmap length] != ( _blockCount + 7 ) / 8 ) return nil;
+
+        const uint8_t *bytes = [bitmap bytes];
+        for ( NSUInteger i = 0; i < _blockCount; i++ ) {
+            if ( bytes[ i / 8 ] & ( 0x80 >> ( i % 8 ) ) ){
+                CFBitVectorSetBitAtIndex( _completed, i, 1 );
+                CFBitVectorSetBitAtIndex( _claimed, i, 1 );
+                _completedBlocks ++;
+            }
+        }
+        [self updateCommittedBlocks];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if ( _requested ) CFRelease( _requested );
+    if ( _completed ) CFRelease( _completed );
+    if ( _claimed )   CFRelease( _claimed );
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Finds the first free block from the cursor and extends the claim over following free blocks up to maxBlocks. Blocks are
+// claimed in order and a released range moves the cursor back, so the search never revisits the claimed start of the object.
+- (NSRange)requestBlocks:(NSUInteger)maxBlocks
+{
+    if ( maxBlocks == 0 || _freeCursor >= _blockCount ) return NSMakeRange( NSNotFound, 0 );
+
+    CFIndex first = CFBitVectorGetFirstIndexOfBit( _claimed, CFRangeMake( _freeCursor, _blockCount - _freeCursor ), 0 );
+    if ( first == kCFNotFound ){
+        _freeCursor = _blockCount;
+        return NSMakeRange( NSNotFound, 0 );
+    }
+
+    CFIndex span = (CFIndex)MIN( (NSUInteger)maxBlocks, _blockCount - (NSUInteger)first );
+    CFIndex next = CFBitVectorGetFirstIndexOfBit( _claimed, CFRangeMake( first, span ), 1 );
+    NSRange blocks = NSMakeRange( (NSUInteger)first, (NSUInteger)( ( next == kCFNotFound ) ? span : next - first ) );
+
+    CFRange range = CFRangeMake( blocks.location, blocks.length );
+    CFBitVectorSetBits( _requested, range, 1 );
+    CFBitVectorSetBits( _claimed, range, 1 );
+    _requestedBlocks   += blocks.length;
+    _freeCursor         = NSMaxRange( blocks );
+    return blocks;
+}
+
+// Counts only the bits that change, so each call costs the length of the range rather than the object.
+- (void)completeBlocks:(NSRange)blocks
+{
+    if ( ! [ self isValidRange: blocks ] ) return;
+
+    CFRange range = CFRangeMake( blocks.location, blocks.length );
+    _requestedBlocks   -= CFBitVectorGetCountOfBit( _requested, range, 1 );
+    _completedBlocks   += blocks.length - CFBitVectorGetCountOfBit( _completed, range, 1 );
+    CFBitVectorSetBits( _requested, range, 0 );
+    CFBitVectorSetBits( _completed, range, 1 );
+    CFBitVectorSetBits( _claimed, range, 1 );
+    [self updateCommittedBlocks];
+}
+
+- (NSData*)completedBitmap
+{
+    NSMutableData *bitmap = [NSMutableData dataWithLength: ( _blockCount + 7 ) / 8 ];
+    if ( _blockCount > 0 ) CFBitVectorGetBits( _completed, CFRangeMake( 0, _blockCount ), [bitmap mutableBytes] );
+    return bitmap;
+}
+
+// Blocks of the range that completed in the meantime stay claimed.
+- (void)releaseBlocks:(NSRange)blocks
+{
+    if ( ! [ self isValidRange: blocks ] ) return;
+
+    CFRange range = CFRangeMake( blocks.location, blocks.length );
+    _requestedBlocks   -= CFBitVectorGetCountOfBit( _requested, range, 1 );
+    CFBitVectorSetBits( _requested, range, 0 );
+    for ( NSUInteger i = blocks.location; i < NSMaxRange( blocks ); i++ ) {
+        if ( ! CFBitVectorGetBitAtIndex( _completed, i ) ) CFBitVectorSetBitAtIndex( _claimed, i, 0 );
+    }
+    _freeCursor         = MIN( _freeCursor, blocks.location );
+}
+
+- (int64_t)offsetOfBlock:(NSUInteger)index
+{
+    int64_t offset = (int64_t)index * (int64_t)_blockSize;
+    return ( offset > _length ) ? _length : offset;
+}
+
+- (int64_t)lengthOfBlocks:(NSRange)blocks
+{
+    return [ self offsetOfBlock: NSMaxRange( blocks ) ] - [ self offsetOfBlock: blocks.location ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters
+// ---------------------------------------------------------------------------------------------------------------------
+- (int64_t)completedLength
+{
+    int64_t completed = (int64_t)_completedBlocks * (int64_t)_blockSize;
+
+    // Only the final block can be short, correct for it if it has been written.
+    if ( _blockCount > 0 && CFBitVectorGetBitAtIndex( _completed, _blockCount - 1 ) ) {
+        completed -= [ self offsetOfBlock: _blockCount - 1 ] + (int64_t)_blockSize - _length;
+    }
+    return completed;
+}
+
+- (int64_t)committedLength
+{
+    return [ self offsetOfBlock: _committedBlocks ];
+}
+
+- (NSUInteger)unrequestedBlocks
+{
+    // A block is never both requested and completed, completing a block clears its request.
+    return _blockCount - _completedBlocks - _requestedBlocks;
+}
+
+- (BOOL)isComplete
+{
+    return _completedBlocks == _blockCount;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)updateCommittedBlocks
+{
+    // Advance the commit point over any blocks that were waiting for this range to complete.
+    while ( _committedBlocks < _blockCount && CFBitVectorGetBitAtIndex( _completed, _committedBlocks ) ) {
+        _committedBlocks ++;
+    }
+}
+
+- (BOOL)isValidRange:(NSRange)blocks
+{
+    return blocks.location != NSNotFound && NSMaxRange( blocks ) <= _blockCount;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+
+@end
@@ -0,0 +1,31 @@
+//
+//  S3BlockOutputStream.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3FileWriter;
+
+/** Output stream handed to an S3GetObjectRequest so that the SDK writes a ranged response directly
+    into its own region of a shared download file. The stream starts at offset and refuses any data
+    beyond length bytes, so a misbehaving response can never overwrite a neighbouring block. Small
+    network chunks are gathered into an S3DH_WRITE_BUFFER_SIZE buffer and written with one positional
+    write, chunks that fill the buffer are written straight from the SDK buffer without a copy.
+ */
+@interface S3BlockOutputStream : NSOutputStream
+
+- (id)initWithFileWriter:(S3FileWriter*)fileWriter offset:(int64_t)offset length:(NSUInteger)length;
+
+/** Writes any buffered data to the file, returns false if the write fails. Called by close.
+ */
+- (BOOL)flush;
+
+/** Number of bytes accepted into the block so far, including bytes still buffered.
+ */
+@property (nonatomic, readonly) NSUInteger  bytesWritten;
+
+@end
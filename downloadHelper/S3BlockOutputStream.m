@@ -0,0 +1,147 @@
+//
+//  S3BlockOutputStream.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BlockOutputStream.h"
+#import "S3FileWriter.h"
+#include <stdlib.h>
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BlockOutputStream ()
+{
+    S3FileWriter            *_fileWriter;               // Shared positional writer on the download file.
+    int64_t                 _offset;                    // File offset of the first byte of the block.
+    NSUInteger              _length;                    // Number of bytes the block may contain.
+    NSUInteger              _bytesWritten;              // Number of bytes accepted into the block.
+
+    uint8_t                 *_buffer;                   // Page aligned coalescing buffer, allocated on first use.
+    NSUInteger              _buffered;                  // Number of bytes waiting in the buffer.
+
+    NSStreamStatus          _status;                    // Stream status reported to the SDK.
+    NSError                 *_error;                    // Error set if a write fails.
+    __weak id <NSStreamDelegate> _delegate;             // Stream delegate, unused but required by NSStream.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3BlockOutputStream
+
+@synthesize bytesWritten    = _bytesWritten;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithFileWriter:(S3FileWriter*)fileWriter offset:(int64_t)offset length:(NSUInteger)length
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _fileWriter = fileWriter ) ) return nil;
+
+        _offset         = offset;
+        _length         = length;
+        _bytesWritten   = 0;
+        _buffered       = 0;
+        _status         = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free( _buffer );
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// NSStream Overrides
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)open                                    { _status = NSStreamStatusOpen;     }
+- (NSStreamStatus)streamStatus                  { return _status;                   }
+- (NSError*)streamError                         { return _error;                    }
+- (id <NSStreamDelegate>)delegate               { return _delegate;                 }
+- (void)setDelegate:(id <NSStreamDelegate>)d    { _delegate = d;                    }
+- (BOOL)hasSpaceAvailable                       { return _status == NSStreamStatusOpen && _bytesWritten < _length; }
+- (id)propertyForKey:(NSString*)key             { return nil;                       }
+- (BOOL)setProperty:(id)property forKey:(NSString*)key                          { return NO; }
+- (void)scheduleInRunLoop:(NSRunLoop*)aRunLoop forMode:(NSString*)mode          {}
+- (void)removeFromRunLoop:(NSRunLoop*)aRunLoop forMode:(NSString*)mode          {}
+
+- (void)close
+{
+    if ( _status == NSStreamStatusOpen ) [self flush];
+    if ( _status != NSStreamStatusError ) _status = NSStreamStatusClosed;
+}
+
+// Accepts the buffer at the current position within the block, truncating anything beyond the block end.
+- (NSInteger)write:(const uint8_t*)buffer maxLength:(NSUInteger)len
+{
+    if ( _status != NSStreamStatusOpen ) return -1;
+
+    NSUInteger available = _length - _bytesWritten;
+    if ( len > available ) len = available;
+    if ( len == 0 ) return 0;
+
+    if ( _buffered + len < S3DH_WRITE_BUFFER_SIZE ) {
+        // Small chunk, gather it with the others.
+        if ( ! _buffer && posix_memalign( (void**)&_buffer, getpagesize(), S3DH_WRITE_BUFFER_SIZE ) != 0 ) {
+            _buffer = NULL;
+            return [self failWithError: nil ];
+        }
+        memcpy( _buffer + _buffered, buffer, len );
+        _buffered += len;
+    }
+    else {
+        // The chunk fills the buffer, write the buffered data and the chunk itself in one call.
+        struct iovec iov[2];
+        iov[0].iov_base = _buffer;
+        iov[0].iov_len  = _buffered;
+        iov[1].iov_base = (void*)buffer;
+        iov[1].iov_len  = len;
+
+        off_t position = (off_t)( _offset + (int64_t)( _bytesWritten - _buffered ) );
+        BOOL written = ( _buffered > 0 ) ? [_fileWriter writeVectors: iov count: 2 atOffset: position ]
+                                         : [_fileWriter writeBytes: buffer length: len atOffset: position ];
+        if ( ! written ) return [self failWithError: _fileWriter.error ];
+        _buffered = 0;
+    }
+
+    _bytesWritten += len;
+    return len;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (BOOL)flush
+{
+    if ( _status == NSStreamStatusError ) return false;
+    if ( _buffered == 0 ) return true;
+
+    off_t position = (off_t)( _offset + (int64_t)( _bytesWritten - _buffered ) );
+    if ( ! [_fileWriter writeBytes: _buffer length: _buffered atOffset: position ] ) {
+        [self failWithError: _fileWriter.error ];
+        return false;
+    }
+    _buffered = 0;
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSInteger)failWithError:(NSError*)error
+{
+    _error  = error;
+    _status = NSStreamStatusError;
+    return -1;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+
+@end
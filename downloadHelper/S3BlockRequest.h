@@ -0,0 +1,48 @@
+//
+//  S3BlockRequest.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3GetObjectRequest;
+@class S3BlockOutputStream;
+@class S3BandwidthReservation;
+
+/** Record of one ranged S3GetObjectRequest in flight for an S3RequestHelper, ties the SDK request to
+    the blocks of the S3BlockMap it is fetching and the stream it is writing into.
+ */
+@interface S3BlockRequest : NSObject
+
+- (id)initWithBlocks:(NSRange)blocks rangeStart:(int64_t)start rangeEnd:(int64_t)end;
+
+/** Cancels the SDK request and closes the output stream.
+ */
+- (void)cancel;
+
+/** Releases a request that has completed and closes the output stream.
+ */
+- (void)finish;
+
+@property (nonatomic, readonly) NSRange                 blocks;         // Block indexes covered by the request.
+@property (nonatomic, readonly) int64_t                 rangeStart;     // First byte requested.
+@property (nonatomic, readonly) int64_t                 rangeEnd;       // Last byte requested, inclusive.
+@property (nonatomic, readonly) int64_t                 length;         // Number of bytes requested.
+@property (nonatomic, assign)   int64_t                 received;       // Number of bytes received so far.
+@property (nonatomic, assign)   NSTimeInterval          startTime;      // Reference time the request was issued.
+@property (nonatomic, assign)   NSTimeInterval          firstByteTime;  // Reference time the response arrived, 0 until then.
+@property (nonatomic, assign)   NSTimeInterval          firstDataTime;  // Reference time the first body byte arrived, 0 until then.
+@property (nonatomic, assign)   NSTimeInterval          windowStart;    // Reference time the current throughput window began.
+@property (nonatomic, assign)   int64_t                 windowReceived; // Bytes received when the current throughput window began.
+
+@property (nonatomic, strong)   S3GetObjectRequest      *request;       // Active SDK request for the range.
+@property (nonatomic, strong)   S3BlockOutputStream     *outputStream;  // Stream the SDK writes the range to.
+@property (nonatomic, strong)   S3BandwidthReservation  *reservation;   // Bandwidth reserved for the range, nil for a hedge.
+
+@property (nonatomic, strong)   S3BlockRequest          *hedge;         // Duplicate request racing this one, nil if not hedged.
+@property (nonatomic, weak)     S3BlockRequest          *primary;       // Request this one is a hedge of, nil for a primary request.
+
+@end
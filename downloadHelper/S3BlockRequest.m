@@ -0,0 +1,64 @@
+//
+//  S3BlockRequest.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 14/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BlockRequest.h"
+#import "S3BlockOutputStream.h"
+#import <AWSS3/AmazonS3Client.h>
+
+@implementation S3BlockRequest
+
+@synthesize blocks          = _blocks;
+@synthesize rangeStart      = _rangeStart;
+@synthesize rangeEnd        = _rangeEnd;
+@synthesize received        = _received;
+@synthesize startTime       = _startTime;
+@synthesize firstByteTime   = _firstByteTime;
+@synthesize firstDataTime   = _firstDataTime;
+@synthesize windowStart     = _windowStart;
+@synthesize windowReceived  = _windowReceived;
+@synthesize request         = _request;
+@synthesize outputStream    = _outputStream;
+@synthesize reservation     = _reservation;
+@synthesize hedge           = _hedge;
+@synthesize primary         = _primary;
+
+- (id)initWithBlocks:(NSRange)blocks rangeStart:(int64_t)start rangeEnd:(int64_t)end
+{
+    self = [super init];
+    if( self ){
+        _blocks     = blocks;
+        _rangeStart = start;
+        _rangeEnd   = end;
+        _received   = 0;
+    }
+    return self;
+}
+
+- (int64_t)length
+{
+    return _rangeEnd - _rangeStart + 1;
+}
+
+- (void)cancel
+{
+    _request.delegate   = nil;
+    [_request cancel];
+    _request            = nil;
+
+    [_outputStream close];
+}
+
+- (void)finish
+{
+    _request.delegate   = nil;
+    _request            = nil;
+
+    [_outputStream close];
+}
+
+@end
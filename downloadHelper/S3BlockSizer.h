@@ -0,0 +1,36 @@
+//
+//  S3BlockSizer.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 15/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/** Chooses the size of the next ranged request for an S3RequestHelper. Each completed block reports
+    its length, total duration and time to first byte, the sizer keeps smoothed estimates of the link
+    throughput and round trip and sizes the next block so that it takes roughly targetDuration seconds,
+    bounded by minBlockSize and maxBlockSize.
+ */
+@interface S3BlockSizer : NSObject
+
+- (id)initWithBlockSize:(NSUInteger)blockSize minBlockSize:(NSUInteger)min maxBlockSize:(NSUInteger)max targetDuration:(NSTimeInterval)target;
+
+/** Records a completed block, duration is measured from issuing the request to the last byte and
+    firstByte from issuing the request to the first byte of the body.
+ */
+- (void)recordBlockOfLength:(NSUInteger)length duration:(NSTimeInterval)duration firstByte:(NSTimeInterval)firstByte;
+
+/** Records a block that timed out or failed part way, the next block size is halved.
+ */
+- (void)recordFailedBlock;
+
+@property (nonatomic, readonly) NSUInteger      blockSize;          // Size to use for the next block request.
+@property (nonatomic, assign)   NSUInteger      minBlockSize;       // Lower bound on the block size.
+@property (nonatomic, assign)   NSUInteger      maxBlockSize;       // Upper bound on the block size.
+@property (nonatomic, assign)   NSTimeInterval  targetDuration;     // Number of seconds a block should take.
+@property (nonatomic, readonly) double          throughput;         // Smoothed throughput in bytes per second.
+@property (nonatomic, readonly) NSTimeInterval  firstByteTime;      // Smoothed time to first byte in seconds.
+
+@end
@@ -0,0 +1,119 @@
+//
+//  S3BlockSizer.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 15/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BlockSizer.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Module Definitions
+// ---------------------------------------------------------------------------------------------------------------------
+#define S3DH_SIZER_SMOOTHING    0.3     // Weight given to the latest sample in the moving averages.
+#define S3DH_SIZER_MAX_GROWTH   2       // Largest factor the block size can grow by after one block.
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BlockSizer ()
+{
+    NSUInteger              _blockSize;                 // Size to use for the next block request.
+    NSUInteger              _minBlockSize;              // Lower bound on the block size.
+    NSUInteger              _maxBlockSize;              // Upper bound on the block size.
+    NSTimeInterval          _targetDuration;            // Number of seconds a block should take.
+
+    double                  _throughput;                // Smoothed body throughput in bytes per second, 0 until measured.
+    NSTimeInterval          _firstByteTime;             // Smoothed time to first byte, 0 until measured.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3BlockSizer
+
+@synthesize blockSize       = _blockSize;
+@synthesize minBlockSize    = _minBlockSize;
+@synthesize maxBlockSize    = _maxBlockSize;
+@synthesize targetDuration  = _targetDuration;
+@synthesize throughput      = _throughput;
+@synthesize firstByteTime   = _firstByteTime;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithBlockSize:(NSUInteger)blockSize minBlockSize:(NSUInteger)min maxBlockSize:(NSUInteger)max targetDuration:(NSTimeInterval)target
+{
+    self = [super init];
+    if( self ){
+        _minBlockSize   = min;
+        _maxBlockSize   = MAX( min, max );
+        _targetDuration = target;
+        _blockSize      = [self clamp: blockSize ];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)recordBlockOfLength:(NSUInteger)length duration:(NSTimeInterval)duration firstByte:(NSTimeInterval)firstByte
+{
+    if ( length == 0 || duration <= 0 ) return;
+
+    // Throughput is measured over the body only, so a slow first byte doesn't count against the link speed.
+    NSTimeInterval streaming = MAX( duration - firstByte, 0.001 );
+    double sample = length / streaming;
+
+    if ( _throughput == 0 ) {
+        _throughput     = sample;
+        _firstByteTime  = firstByte;
+    }
+    else {
+        _throughput     = S3DH_SIZER_SMOOTHING * sample    + ( 1 - S3DH_SIZER_SMOOTHING ) * _throughput;
+        _firstByteTime  = S3DH_SIZER_SMOOTHING * firstByte + ( 1 - S3DH_SIZER_SMOOTHING ) * _firstByteTime;
+    }
+
+    // Size the next block so that first byte plus body time meets the target, growing gradually.
+    NSTimeInterval budget = _targetDuration - _firstByteTime;
+    NSUInteger target = ( budget > 0 ) ? (NSUInteger)( _throughput * budget ) : _minBlockSize;
+    if ( target > _blockSize * S3DH_SIZER_MAX_GROWTH ) target = _blockSize * S3DH_SIZER_MAX_GROWTH;
+
+    _blockSize = [self clamp: target ];
+}
+
+- (void)recordFailedBlock
+{
+    _blockSize = [self clamp: _blockSize / 2 ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)setMinBlockSize:(NSUInteger)minBlockSize
+{
+    _minBlockSize   = minBlockSize;
+    _maxBlockSize   = MAX( _minBlockSize, _maxBlockSize );
+    _blockSize      = [self clamp: _blockSize ];
+}
+
+- (void)setMaxBlockSize:(NSUInteger)maxBlockSize
+{
+    _maxBlockSize   = MAX( _minBlockSize, maxBlockSize );
+    _blockSize      = [self clamp: _blockSize ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)clamp:(NSUInteger)size
+{
+    if ( size < _minBlockSize ) return _minBlockSize;
+    if ( size > _maxBlockSize ) return _maxBlockSize;
+    return size;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+
+@end
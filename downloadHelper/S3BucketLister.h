@@ -0,0 +1,56 @@
+//
+//  S3BucketLister.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 27/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <AWSS3/AWSS3.h>
+
+@class S3TransferEngine;
+
+#define S3DH_LIST_PAGE_SIZE         1000    // Keys requested per listing page, the most S3 returns in one.
+#define S3DH_LIST_FANOUT            4       // Listing requests in flight at once across the partitions.
+#define S3DH_LIST_BUFFERED_PAGES    8       // Pages listed ahead of the merged stream before partitions wait for it.
+#define S3DH_LIST_DELIMITER         @"/"    // Separates the levels of the key space partitions are taken from.
+
+/** Lists a bucket in key order with several requests in flight at once. The top level of the bucket is
+    listed with S3DH_LIST_DELIMITER, each common prefix it returns becomes a partition that is listed
+    on its own worker, and the partitions are listed concurrently up to maxConcurrentRequests. A bucket
+    whose keys all sit under one prefix is split one level further down.
+
+    The pages of the partitions are merged back into one stream in key order, a partition that gets ahead
+    of the stream keeps its pages until the partitions before it have been handed on, and stops listing
+    while S3DH_LIST_BUFFERED_PAGES pages are waiting. The partition at the front of the stream is never
+    held back, so the first page reaches the handler after a single round trip.
+
+    Keys under excludedPrefixes are pruned from the requests themselves: a prefix that is excluded is never
+    listed, and a partition with an excluded prefix below it is listed one level at a time down to it. Keys
+    that are listed alongside such a prefix at the same level are filtered out before they are handed on.
+
+    All methods must be called on the engine thread, the page handler and completion are called on it.
+ */
+@interface S3BucketLister : NSObject
+
+- (id)initWithS3Client:(AmazonS3Client*)s3 bucket:(NSString*)bucket engine:(S3TransferEngine*)engine;
+
+/** Lists the bucket, handing each page of S3ObjectSummaries to the page handler in key order and calling
+    the completion once the last page has been handed on or a request has failed. A listing that is still
+    running is cancelled first.
+ */
+- (void)listWithPageHandler:(void (^)(NSArray *summaries))pageHandler completion:(void (^)(BOOL succeeded))completion;
+
+/** Stops the listing in progress without calling its completion, requests already sent are ignored.
+ */
+- (void)cancel;
+
+@property (nonatomic, copy)     NSArray         *excludedPrefixes;      // Key prefixes never listed, applied from the next listing.
+@property (nonatomic, assign)   NSUInteger      maxConcurrentRequests;  // Most listing requests in flight at once.
+@property (nonatomic, assign)   NSUInteger      pageSize;               // Keys requested per page.
+@property (nonatomic, readonly) BOOL            isListing;              // True while a listing is in progress.
+@property (nonatomic, readonly) NSUInteger      requests;               // Listing requests sent since the lister was created.
+@property (nonatomic, readonly) NSUInteger      partitions;             // Prefixes listed as partitions since the lister was created.
+
+@end
@@ -0,0 +1,346 @@
+//
+//  S3BucketLister.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 27/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3BucketLister.h"
+#import "S3TransferEngine.h"
+#import "S3ListingDiff.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// S3ListPartition
+// ---------------------------------------------------------------------------------------------------------------------
+
+// One prefix of the bucket and the part of its listing that has not yet been merged. Items are pages of summaries and child
+// partitions, in key order.
+@interface S3ListPartition : NSObject
+
+- (id)initWithPrefix:(NSString*)prefix delimited:(BOOL)delimited;
+
+@property (nonatomic, readonly) NSString        *prefix;            // Prefix listed, empty for the whole bucket.
+@property (nonatomic, readonly) BOOL            delimited;          // Lists one level, common prefixes become child partitions.
+@property (nonatomic, strong)   NSString        *marker;            // Key the next page starts after, nil for the first page.
+@property (nonatomic, assign)   BOOL            requesting;         // True while a page request is in flight.
+@property (nonatomic, assign)   BOOL            listed;             // True once the last page has arrived.
+@property (nonatomic, readonly) NSMutableArray  *items;             // Pages and child partitions waiting to be merged.
+
+@end
+
+@implementation S3ListPartition
+
+@synthesize prefix          = _prefix;
+@synthesize delimited       = _delimited;
+@synthesize marker          = _marker;
+@synthesize requesting      = _requesting;
+@synthesize listed          = _listed;
+@synthesize items           = _items;
+
+- (id)initWithPrefix:(NSString*)prefix delimited:(BOOL)delimited
+{
+    self = [super init];
+    if( self ){
+        _prefix     = prefix;
+        _delimited  = delimited;
+        _items      = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3BucketLister ()
+{
+    AmazonS3Client          *_s3;                       // Client the listing requests are sent with.
+    NSString                *_bucket;                   // Bucket listed.
+    S3TransferEngine        *_engine;                   // Engine the requests are made from and the pages merged on.
+
+    NSArray                 *_excludedPrefixes;         // Key prefixes never listed.
+    NSUInteger              _maxConcurrentRequests;     // Most listing requests in flight at once.
+    NSUInteger              _pageSize;                  // Keys requested per page.
+
+    S3ListPartition         *_root;                     // Partition for the whole bucket, nil when not listing.
+    NSArray                 *_listingExclusions;        // Excluded prefixes of the listing in progress.
+    void (^_pageHandler)(NSArray*);                     // Called with each page in key order.
+    void (^_completion)(BOOL);                          // Called once the listing has finished or failed.
+    NSUInteger              _generation;                // Incremented per listing so that replies to an earlier one are ignored.
+    NSUInteger              _inFlight;                  // Listing requests awaiting a reply.
+    NSUInteger              _bufferedPages;             // Pages listed but not yet merged.
+
+    NSUInteger              _requests;                  // Listing requests sent since the lister was created.
+    NSUInteger              _partitions;                // Prefixes listed as partitions since the lister was created.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3BucketLister
+
+@synthesize excludedPrefixes        = _excludedPrefixes;
+@synthesize pageSize                = _pageSize;
+@synthesize requests                = _requests;
+@synthesize partitions              = _partitions;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithS3Client:(AmazonS3Client*)s3 bucket:(NSString*)bucket engine:(S3TransferEngine*)engine
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _s3     = s3     ) ) return nil;
+        if ( ! ( _bucket = bucket ) ) return nil;
+        if ( ! ( _engine = engine ) ) return nil;
+
+        _maxConcurrentRequests  = S3DH_LIST_FANOUT;
+        _pageSize               = S3DH_LIST_PAGE_SIZE;
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)listWithPageHandler:(void (^)(NSArray *summaries))pageHandler completion:(void (^)(BOOL succeeded))completion
+{
+    [self cancel];
+
+    _pageHandler        = [pageHandler copy];
+    _completion         = [completion copy];
+    _listingExclusions  = [_excludedPrefixes copy];
+    _root               = [[S3ListPartition alloc] initWithPrefix: @"" delimited: YES ];
+    [self requestPages];
+}
+
+- (void)cancel
+{
+    _generation ++;
+    _root           = nil;
+    _pageHandler    = nil;
+    _completion     = nil;
+    _inFlight       = 0;
+    _bufferedPages  = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (BOOL)isListing           { return _root != nil;      }
+
+- (NSUInteger)maxConcurrentRequests
+{
+    return _maxConcurrentRequests;
+}
+
+- (void)setMaxConcurrentRequests:(NSUInteger)maxConcurrentRequests
+{
+    _maxConcurrentRequests = MAX( maxConcurrentRequests, 1 );
+    if ( _root ) [self requestPages];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Fills the free request slots with the partitions earliest in key order, so listing runs as little ahead of the merged
+// stream as it can.
+- (void)requestPages
+{
+    S3ListPartition *head = [self headPartition];
+    while ( _inFlight < _maxConcurrentRequests ) {
+        S3ListPartition *partition = [self nextPartitionIn: _root head: head ];
+        if ( ! partition ) break;
+        [self requestPageOfPartition: partition ];
+    }
+}
+
+// Once merged, the front of the tree is a chain of partitions ending in the one the stream is waiting on.
+- (S3ListPartition*)headPartition
+{
+    S3ListPartition *head = _root;
+    while ( [head.items count] > 0 ) head = [head.items objectAtIndex: 0 ];
+    return head;
+}
+
+// A partition's items come before the keys of its next page, so they are searched first. Only the head may list while the
+// buffer is full, and a delimited partition stops discovering children while enough are still listing to fill the slots.
+- (S3ListPartition*)nextPartitionIn:(S3ListPartition*)partition head:(S3ListPartition*)head
+{
+    NSUInteger listingChildren = 0;
+    for ( id item in partition.items ) {
+        if ( ! [item isKindOfClass: [S3ListPartition class]] ) continue;
+
+        S3ListPartition *next = [self nextPartitionIn: item head: head ];
+        if ( next ) return next;
+        if ( ! [item listed] ) listingChildren ++;
+    }
+
+    if ( partition.listed || partition.requesting ) return nil;
+    if ( partition == head ) return partition;
+    if ( _bufferedPages >= S3DH_LIST_BUFFERED_PAGES ) return nil;
+    if ( partition.delimited && listingChildren >= _maxConcurrentRequests ) return nil;
+    return partition;
+}
+
+- (void)requestPageOfPartition:(S3ListPartition*)partition
+{
+    S3ListObjectsRequest *request = [[S3ListObjectsRequest alloc] initWithName: _bucket ];
+    request.prefix      = [partition.prefix length] ? partition.prefix : nil;
+    request.delimiter   = partition.delimited ? S3DH_LIST_DELIMITER : nil;
+    request.marker      = partition.marker;
+    request.maxKeys     = (int32_t)_pageSize;
+
+    partition.requesting = YES;
+    _inFlight ++;
+    _requests ++;
+
+    AmazonS3Client *s3          = _s3;
+    S3TransferEngine *engine    = _engine;
+    NSUInteger generation       = _generation;
+    __weak S3BucketLister *weakSelf = self;
+
+    [_engine performWorkerBlock:^{
+        S3ListObjectsResult *page = nil;
+        @try{
+            page = [s3 listObjects: request ].listObjectsResult;
+        }
+        @catch ( AmazonServiceException *serviceException ) {
+            NSLog(@"Service Exception Occured: %@", serviceException.errorCode);
+        }
+        @catch (AmazonClientException *clientException) {
+            NSLog(@"Client Exception Occured: %@", clientException.error.localizedDescription);
+        }
+        [engine performBlock:^{ [weakSelf partition: partition didListPage: page generation: generation ]; }];
+    }];
+}
+
+- (void)partition:(S3ListPartition*)partition didListPage:(S3ListObjectsResult*)page generation:(NSUInteger)generation
+{
+    if ( generation != _generation ) return;
+
+    _inFlight --;
+    partition.requesting = NO;
+    if ( ! page ){
+        [self finishListing: NO ];
+        return;
+    }
+
+    [self addPage: page toPartition: partition ];
+    [self mergePartition: _root ];
+
+    // The page handler may have started another listing.
+    if ( generation != _generation ) return;
+    if ( _root.listed && [_root.items count] == 0 ){
+        [self finishListing: YES ];
+        return;
+    }
+    [self requestPages];
+}
+
+// S3 returns the objects and the common prefixes of a page as two sorted lists, a prefix sorts where its keys would so the two
+// are interleaved back into key order. Runs of objects become pages and prefixes become child partitions.
+- (void)addPage:(S3ListObjectsResult*)page toPartition:(S3ListPartition*)partition
+{
+    NSArray *summaries  = page.objectSummaries;
+    NSArray *prefixes   = page.commonPrefixes;
+
+    // A level holding a single prefix and nothing else is split again, or the whole bucket would be listed as one partition.
+    BOOL splitChildren  = partition.marker == nil && ! page.isTruncated && [summaries count] == 0 && [prefixes count] == 1;
+
+    NSMutableArray *run = [[NSMutableArray alloc] init];
+    NSUInteger s = 0, p = 0;
+    while ( s < [summaries count] || p < [prefixes count] ) {
+
+        S3ObjectSummary *summary    = ( s < [summaries count] ) ? [summaries objectAtIndex: s ] : nil;
+        NSString *prefix            = ( p < [prefixes count] ) ? [prefixes objectAtIndex: p ] : nil;
+
+        if ( summary && ( ! prefix || [S3ListingDiff compareKey: summary.key toKey: prefix ] == NSOrderedAscending ) ){
+            if ( ! [self isExcludedKey: summary.key ] ) [run addObject: summary ];
+            s ++;
+            continue;
+        }
+        p ++;
+        if ( [self isExcludedKey: prefix ] ) continue;
+
+        [self addRun: run toPartition: partition ];
+        run = [[NSMutableArray alloc] init];
+
+        BOOL delimited = splitChildren || [self hasExclusionBelowPrefix: prefix ];
+        [partition.items addObject: [[S3ListPartition alloc] initWithPrefix: prefix delimited: delimited ] ];
+        _partitions ++;
+    }
+    [self addRun: run toPartition: partition ];
+
+    // Without a delimiter S3 leaves nextMarker unset, the next page starts after the last key or prefix of this one.
+    NSString *marker = nil;
+    if ( page.isTruncated ){
+        marker = page.nextMarker;
+        if ( ! marker ){
+            NSString *lastKey       = [[summaries lastObject] key];
+            NSString *lastPrefix    = [prefixes lastObject];
+            marker = lastPrefix;
+            if ( lastKey && ( ! lastPrefix || [S3ListingDiff compareKey: lastKey toKey: lastPrefix ] == NSOrderedDescending ) ) marker = lastKey;
+        }
+    }
+    partition.marker = marker;
+    partition.listed = ( marker == nil );
+}
+
+- (void)addRun:(NSArray*)run toPartition:(S3ListPartition*)partition
+{
+    if ( [run count] == 0 ) return;
+    [partition.items addObject: run ];
+    _bufferedPages ++;
+}
+
+// Hands the pages at the front of the tree to the page handler and drops the partitions that have been merged completely.
+// Returns true once the partition is listed and has nothing left to merge.
+- (BOOL)mergePartition:(S3ListPartition*)partition
+{
+    NSUInteger generation = _generation;
+    while ( [partition.items count] > 0 ) {
+
+        id item = [partition.items objectAtIndex: 0 ];
+        if ( [item isKindOfClass: [S3ListPartition class]] ){
+            if ( ! [self mergePartition: item ] ) return NO;
+        }
+        else{
+            _bufferedPages --;
+            _pageHandler( item );
+            if ( generation != _generation ) return NO;
+        }
+        [partition.items removeObjectAtIndex: 0 ];
+    }
+    return partition.listed;
+}
+
+- (void)finishListing:(BOOL)succeeded
+{
+    void (^completion)(BOOL) = _completion;
+    [self cancel];
+    if ( completion ) completion( succeeded );
+}
+
+- (BOOL)isExcludedKey:(NSString*)key
+{
+    for ( NSString *excluded in _listingExclusions ) {
+        if ( [key hasPrefix: excluded ] ) return true;
+    }
+    return false;
+}
+
+- (BOOL)hasExclusionBelowPrefix:(NSString*)prefix
+{
+    for ( NSString *excluded in _listingExclusions ) {
+        if ( [excluded length] > [prefix length] && [excluded hasPrefix: prefix ] ) return true;
+    }
+    return false;
+}
+
+@end
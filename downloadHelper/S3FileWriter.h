@@ -0,0 +1,55 @@
+//
+//  S3FileWriter.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 18/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <sys/uio.h>
+
+#define S3DH_WRITE_BUFFER_SIZE 262144       // Size of the coalescing buffer each block stream gathers network chunks into.
+
+/** Download file backed by a raw file descriptor. Every write is positional, so any number of block
+    streams can write into the same file at their own offsets in any order without seeking each other.
+    Writers are not thread safe and must only be used from the engine thread.
+ */
+@interface S3FileWriter : NSObject
+
+/** Opens the file at path for writing, creating it if it does not exist and emptying it if truncate is
+    set. Returns nil and sets error if the file cannot be opened.
+ */
+- (id)initWithPath:(NSString*)path truncate:(BOOL)truncate error:(NSError**)error;
+
+/** Writes length bytes at offset, retrying short writes. Returns false and sets error on failure.
+ */
+- (BOOL)writeBytes:(const void*)bytes length:(size_t)length atOffset:(off_t)offset;
+
+/** Gathers the buffers described by iov into a single write at offset. Returns false and sets error on failure.
+ */
+- (BOOL)writeVectors:(const struct iovec*)iov count:(int)count atOffset:(off_t)offset;
+
+/** Sets the file length, extending with zeros or truncating.
+ */
+- (BOOL)truncateToLength:(off_t)length;
+
+/** Reserves storage for the full length of the file and sets the file length, so a download can never
+    run out of space part way through and blocks land in contiguous extents. Uses F_PREALLOCATE on
+    Darwin and posix_fallocate on Linux. Returns false with ENOSPC in error if the space is not available.
+ */
+- (BOOL)preallocateLength:(off_t)length;
+
+/** Flushes written data to storage.
+ */
+- (BOOL)synchronise;
+
+/** Closes the file descriptor, further writes fail.
+ */
+- (void)close;
+
+@property (nonatomic, readonly) int         fileDescriptor;     // Raw descriptor, -1 once closed.
+@property (nonatomic, readonly) NSString    *path;              // Path the writer was opened on.
+@property (nonatomic, readonly) NSError     *error;             // Error set by the last failed operation.
+
+@end
@@ -0,0 +1,165 @@
+//
+//  S3FileWriter.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 18/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3FileWriter.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3FileWriter ()
+{
+    int                     _fd;                        // Raw file descriptor, -1 once closed.
+    NSString                *_path;                     // Path the writer was opened on.
+    NSError                 *_error;                    // Error set by the last failed operation.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3FileWriter
+
+@synthesize fileDescriptor  = _fd;
+@synthesize path            = _path;
+@synthesize error           = _error;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithPath:(NSString*)path truncate:(BOOL)truncate error:(NSError**)error
+{
+    self = [super init];
+    if( self ){
+        _path   = path;
+        _fd     = open( [path fileSystemRepresentation], O_RDWR | O_CREAT | ( truncate ? O_TRUNC : 0 ), 0644 );
+
+        if ( _fd < 0 ) {
+            [self recordError];
+            if ( error ) *error = _error;
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self close];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (BOOL)writeBytes:(const void*)bytes length:(size_t)length atOffset:(off_t)offset
+{
+    const uint8_t *buffer = bytes;
+
+    while ( length > 0 ) {
+        ssize_t written = pwrite( _fd, buffer, length, offset );
+        if ( written < 0 ) {
+            if ( errno == EINTR ) continue;
+            return [self recordError];
+        }
+        buffer  += written;
+        length  -= written;
+        offset  += written;
+    }
+    return true;
+}
+
+- (BOOL)writeVectors:(const struct iovec*)iov count:(int)count atOffset:(off_t)offset
+{
+    size_t total = 0;
+    for ( int i = 0; i < count; i++ ) total += iov[i].iov_len;
+
+#if defined(__linux__)
+    ssize_t written;
+    do { written = pwritev( _fd, iov, count, offset ); } while ( written < 0 && errno == EINTR );
+#else
+    // There is no positional writev on iOS, the writer is only used from the engine thread so seek and write is safe.
+    ssize_t written = -1;
+    if ( lseek( _fd, offset, SEEK_SET ) == offset ) {
+        do { written = writev( _fd, iov, count ); } while ( written < 0 && errno == EINTR );
+    }
+#endif
+    if ( written < 0 ) return [self recordError];
+    if ( (size_t)written == total ) return true;
+
+    // Finish a short write buffer by buffer with positional writes.
+    size_t skip = written;
+    for ( int i = 0; i < count; i++ ) {
+        if ( skip >= iov[i].iov_len ) { skip -= iov[i].iov_len; continue; }
+
+        const uint8_t *base = (const uint8_t*)iov[i].iov_base + skip;
+        size_t length       = iov[i].iov_len - skip;
+        if ( ! [self writeBytes: base length: length atOffset: offset + written ] ) return false;
+        written += length;
+        skip     = 0;
+    }
+    return true;
+}
+
+- (BOOL)truncateToLength:(off_t)length
+{
+    if ( ftruncate( _fd, length ) != 0 ) return [self recordError];
+    return true;
+}
+
+- (BOOL)preallocateLength:(off_t)length
+{
+    if ( length <= 0 ) return [self truncateToLength: 0 ];
+
+#if defined(__linux__)
+    int result = posix_fallocate( _fd, 0, length );
+    if ( result != 0 ) {
+        errno = result;
+        return [self recordError];
+    }
+#else
+    // Ask for a contiguous reservation first and accept a fragmented one if that is all the volume can give.
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, length, 0 };
+    if ( fcntl( _fd, F_PREALLOCATE, &store ) == -1 ) {
+        store.fst_flags = F_ALLOCATEALL;
+        if ( fcntl( _fd, F_PREALLOCATE, &store ) == -1 ) return [self recordError];
+    }
+#endif
+    return [self truncateToLength: length ];
+}
+
+- (BOOL)synchronise
+{
+    if ( fsync( _fd ) != 0 ) return [self recordError];
+    return true;
+}
+
+- (void)close
+{
+    if ( _fd >= 0 ) close( _fd );
+    _fd = -1;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Captures errno as an NSError, always returns false so failures can return the call directly.
+- (BOOL)recordError
+{
+    int code = errno;
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:
+                              [NSString stringWithUTF8String: strerror( code ) ], NSLocalizedDescriptionKey,
+                              _path, NSFilePathErrorKey, nil ];
+    _error = [NSError errorWithDomain: NSPOSIXErrorDomain code: code userInfo: userInfo ];
+    return false;
+}
+// ---------------------------------------------------------------------------------------------------------------------
+
+@end
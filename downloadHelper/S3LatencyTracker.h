@@ -0,0 +1,51 @@
+//
+//  S3LatencyTracker.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 21/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#define S3DH_LATENCY_SAMPLES        64      // Number of recent block durations kept for the percentile.
+#define S3DH_LATENCY_MIN_SAMPLES    8       // Samples needed before a percentile is reported.
+#define S3DH_HEDGE_RATIO            0.05    // Largest fraction of block requests that may be hedged.
+
+/** Keeps the durations and lengths of the most recent completed block requests and reports percentiles of
+    them, used to decide when a block has taken unusually long. A percentile is taken over the blocks of the
+    same size class, lengths within a factor of two, and falls back to the duration per byte of every block
+    scaled to the length asked for while the class has too few samples.
+
+    The tracker also holds the hedge allowance of everything that shares it: at most hedgeRatio of the
+    block requests counted with recordRequest may be hedged. Trackers are not thread safe and must only be
+    used from the engine thread.
+ */
+@interface S3LatencyTracker : NSObject
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+/** Adds the duration of a completed block of length bytes, replacing the oldest sample once the tracker is full.
+ */
+- (void)recordDuration:(NSTimeInterval)duration forLength:(int64_t)length;
+
+/** Duration that the given fraction of recent blocks of about length bytes completed within, 0.95 for the 95th
+    percentile. Returns 0 until S3DH_LATENCY_MIN_SAMPLES have been recorded.
+ */
+- (NSTimeInterval)percentile:(double)fraction forLength:(int64_t)length;
+
+/** Counts a primary block request towards the hedge allowance.
+ */
+- (void)recordRequest;
+
+/** Takes a hedge from the allowance, returns false if another hedge would exceed hedgeRatio of the requests.
+ */
+- (BOOL)acquireHedge;
+
+@property (nonatomic, readonly) NSUInteger      capacity;           // Most samples kept.
+@property (nonatomic, readonly) NSUInteger      sampleCount;        // Samples currently kept.
+@property (nonatomic, assign)   double          hedgeRatio;         // Largest fraction of requests hedged, S3DH_HEDGE_RATIO by default.
+@property (nonatomic, readonly) NSUInteger      requestCount;       // Primary block requests counted.
+@property (nonatomic, readonly) NSUInteger      hedgeCount;         // Hedges taken from the allowance.
+
+@end
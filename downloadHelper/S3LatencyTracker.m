@@ -0,0 +1,132 @@
+//
+//  S3LatencyTracker.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 21/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3LatencyTracker.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3LatencyTracker ()
+{
+    NSUInteger              _capacity;                  // Most samples kept.
+    NSMutableArray          *_durations;                // Durations in the order they were recorded, oldest first.
+    NSMutableArray          *_lengths;                  // Block length of each duration.
+    double                  _hedgeRatio;                // Largest fraction of requests hedged.
+    NSUInteger              _requestCount;              // Primary block requests counted.
+    NSUInteger              _hedgeCount;                // Hedges taken from the allowance.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3LatencyTracker
+
+@synthesize capacity        = _capacity;
+@synthesize hedgeRatio      = _hedgeRatio;
+@synthesize requestCount    = _requestCount;
+@synthesize hedgeCount      = _hedgeCount;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)init
+{
+    return [self initWithCapacity: S3DH_LATENCY_SAMPLES ];
+}
+
+- (id)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if( self ){
+        _capacity   = MAX( capacity, (NSUInteger)1 );
+        _durations  = [[NSMutableArray alloc] initWithCapacity: _capacity ];
+        _lengths    = [[NSMutableArray alloc] initWithCapacity: _capacity ];
+        _hedgeRatio = S3DH_HEDGE_RATIO;
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Synthesized Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)sampleCount
+{
+    return [_durations count];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)recordDuration:(NSTimeInterval)duration forLength:(int64_t)length
+{
+    if( length <= 0 ) return;
+
+    if( [_durations count] == _capacity ){
+        [_durations removeObjectAtIndex: 0 ];
+        [_lengths removeObjectAtIndex: 0 ];
+    }
+    [_durations addObject: [NSNumber numberWithDouble: duration] ];
+    [_lengths addObject: [NSNumber numberWithLongLong: length] ];
+}
+
+- (NSTimeInterval)percentile:(double)fraction forLength:(int64_t)length
+{
+    NSUInteger count = [_durations count];
+    if( count < S3DH_LATENCY_MIN_SAMPLES || length <= 0 ) return 0;
+
+    // Blocks of the same size class are compared directly, they pay the same first byte latency.
+    int sizeClass = [self sizeClassOfLength: length ];
+    NSMutableArray *matching = [[NSMutableArray alloc] initWithCapacity: count ];
+    for( NSUInteger i = 0; i < count; i++ ){
+        if( [self sizeClassOfLength: [[_lengths objectAtIndex: i] longLongValue]] == sizeClass ) [matching addObject: [_durations objectAtIndex: i] ];
+    }
+    if( [matching count] >= S3DH_LATENCY_MIN_SAMPLES ) return [self percentile: fraction ofSamples: matching ];
+
+    // Otherwise scale the time per byte of every block to the length asked for.
+    NSMutableArray *scaled = [[NSMutableArray alloc] initWithCapacity: count ];
+    for( NSUInteger i = 0; i < count; i++ ){
+        double perByte = [[_durations objectAtIndex: i] doubleValue] / [[_lengths objectAtIndex: i] longLongValue];
+        [scaled addObject: [NSNumber numberWithDouble: perByte * length] ];
+    }
+    return [self percentile: fraction ofSamples: scaled ];
+}
+
+- (void)recordRequest
+{
+    _requestCount ++;
+}
+
+- (BOOL)acquireHedge
+{
+    if( ( _hedgeCount + 1 ) > _requestCount * _hedgeRatio ) return false;
+    _hedgeCount ++;
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Lengths within the same power of two share a class.
+- (int)sizeClassOfLength:(int64_t)length
+{
+    int sizeClass = 0;
+    while( length > 1 ){ length >>= 1; sizeClass ++; }
+    return sizeClass;
+}
+
+// Nearest rank on a sorted copy, the sample count is small enough that sorting on demand is cheap.
+- (NSTimeInterval)percentile:(double)fraction ofSamples:(NSArray*)samples
+{
+    NSArray *sorted = [samples sortedArrayUsingSelector: @selector(compare:) ];
+    NSUInteger rank = (NSUInteger)ceil( MIN( MAX( fraction, 0.0 ), 1.0 ) * [sorted count] );
+    return [[sorted objectAtIndex: MAX( rank, (NSUInteger)1 ) - 1] doubleValue];
+}
+
+@end
@@ -0,0 +1,58 @@
+//
+//  S3ListingDiff.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 28/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <AWSS3/AWSS3.h>
+
+typedef enum{
+    S3DH_KEY_ADDED = 0,                         // In the new listing only.
+    S3DH_KEY_REMOVED,                           // In the previous listing only, summary is the previous one.
+    S3DH_KEY_CHANGED,                           // In both with a different ETag or size.
+    S3DH_KEY_UNCHANGED                          // In both with the same ETag and size.
+} S3DH_KEY_DIFF;
+
+/** Compares a new listing of a bucket with the previous one as its pages arrive. Both listings are in
+    S3 key order, so the diff is a merge join: a cursor walks the previous listing alongside the new pages
+    and each key is reported to the handler once, in key order, as soon as its fate is known. A key of the
+    previous listing is reported removed as soon as the new listing has passed it, without waiting for
+    the listing to finish.
+
+    The diff is not constant in memory: it builds the new listing in key order, because that listing is the
+    baseline the next diff walks. Previous summaries are dropped as the cursor passes them, so the unreported
+    part of the previous listing and the new listing so far together hold about one listing, never two.
+    Beyond that the diff keeps nothing per key, and nothing is hashed or looked up.
+ */
+@interface S3ListingDiff : NSObject
+
+/** Sorts summaries by key in S3 key order, the order pages are listed in.
+ */
++ (NSArray*)sortedSummaries:(NSArray*)summaries;
+
+/** Compares keys by their UTF-8 bytes, the order S3 lists keys in.
+ */
++ (NSComparisonResult)compareKey:(NSString*)key toKey:(NSString*)other;
+
+/** Diff against the previous listing, an array of S3ObjectSummary in S3 key order. A mutable array is taken
+    over and emptied as the diff runs rather than copied.
+ */
+- (id)initWithSummaries:(NSArray*)previous handler:(void (^)(S3DH_KEY_DIFF diff, S3ObjectSummary *summary))handler;
+
+/** Reports the keys of the next page of the new listing, and the previous keys that sort before its last key.
+ */
+- (void)diffPage:(NSArray*)summaries;
+
+/** Reports the previous keys the new listing did not reach as removed. Call once the listing is complete.
+ */
+- (void)finish;
+
+/** The new listing so far followed by the previous keys not yet reached, in key order. After finish it is the
+    new listing, after a failed listing it keeps every key that has not been shown to be gone.
+ */
+@property (nonatomic, readonly) NSArray             *summaries;
+
+@end
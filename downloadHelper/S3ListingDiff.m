@@ -0,0 +1,109 @@
+//
+//  S3ListingDiff.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 28/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3ListingDiff.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3ListingDiff ()
+{
+    NSMutableArray          *_previous;                 // Previous summaries not yet reported, in key order.
+    NSMutableArray          *_listed;                   // New listing so far, in key order.
+    void (^_handler)(S3DH_KEY_DIFF, S3ObjectSummary*);  // Called once per key of either listing.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3ListingDiff
+
++ (NSArray*)sortedSummaries:(NSArray*)summaries
+{
+    return [summaries sortedArrayUsingComparator:^NSComparisonResult( S3ObjectSummary *a, S3ObjectSummary *b ) {
+        return [S3ListingDiff compareKey: a.key toKey: b.key ];
+    }];
+}
+
++ (NSComparisonResult)compareKey:(NSString*)key toKey:(NSString*)other
+{
+    int result = strcmp( [key UTF8String], [other UTF8String] );
+    if ( result == 0 ) return NSOrderedSame;
+    return ( result < 0 ) ? NSOrderedAscending : NSOrderedDescending;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithSummaries:(NSArray*)previous handler:(void (^)(S3DH_KEY_DIFF diff, S3ObjectSummary *summary))handler
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _handler = [handler copy] ) ) return nil;
+
+        _previous   = [previous isKindOfClass: [NSMutableArray class]] ? (NSMutableArray*)previous : [previous mutableCopy];
+        if ( ! _previous ) _previous = [[NSMutableArray alloc] init];
+        _listed     = [[NSMutableArray alloc] initWithCapacity: [_previous count] ];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)diffPage:(NSArray*)summaries
+{
+    for ( S3ObjectSummary *summary in summaries ) {
+
+        // Previous keys sorting before this one are missing from the new listing. Reported summaries are dropped from the front
+        // as the cursor passes them, so the two listings together never hold more than one listing's worth of summaries.
+        NSComparisonResult order = NSOrderedDescending;
+        while ( [_previous count] > 0 ) {
+            S3ObjectSummary *previous = [_previous objectAtIndex: 0 ];
+            order = [S3ListingDiff compareKey: previous.key toKey: summary.key ];
+            if ( order != NSOrderedAscending ) break;
+
+            [_previous removeObjectAtIndex: 0 ];
+            _handler( S3DH_KEY_REMOVED, previous );
+        }
+
+        if ( [_previous count] > 0 && order == NSOrderedSame ){
+            S3ObjectSummary *previous = [_previous objectAtIndex: 0 ];
+            [_previous removeObjectAtIndex: 0 ];
+
+            BOOL changed = previous.size != summary.size || ! [previous.etag isEqualToString: summary.etag ];
+            _handler( changed ? S3DH_KEY_CHANGED : S3DH_KEY_UNCHANGED, summary );
+        }
+        else{
+            _handler( S3DH_KEY_ADDED, summary );
+        }
+        [_listed addObject: summary ];
+    }
+}
+
+- (void)finish
+{
+    while ( [_previous count] > 0 ) {
+        S3ObjectSummary *previous = [_previous objectAtIndex: 0 ];
+        [_previous removeObjectAtIndex: 0 ];
+        _handler( S3DH_KEY_REMOVED, previous );
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSArray*)summaries
+{
+    NSMutableArray *summaries = [_listed mutableCopy];
+    [summaries addObjectsFromArray: _previous ];
+    return summaries;
+}
+
+@end
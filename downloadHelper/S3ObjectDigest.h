@@ -0,0 +1,66 @@
+//
+//  S3ObjectDigest.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 19/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CommonCrypto/CommonDigest.h>
+
+#define S3DH_DIGEST_READ_SIZE 262144        // Size of the reads used to hash data that is already on disk.
+#define S3DH_DIGEST_MAX_PART_SIZES 3        // Most part sizes hashed at once when the part size of an ETag is inferred.
+#define S3DH_DIGEST_UNVERIFIABLE @"unverifiable"    // Digest of a multipart ETag that no part size fits.
+
+/** Running MD5 of an object that is downloaded in ranges. Bytes are accepted at any offset but only the
+    bytes that continue from hashedOffset are hashed, earlier bytes are skipped and later bytes are left
+    for a catch up read once the gap before them has been written. The hash state can be saved and
+    restored so that a resumed download does not need to hash the file again.
+
+    Objects uploaded in parts have an ETag of the form md5-N, the MD5 of the N part MD5s. The part size
+    is not listed, so the digest is built with the configured part size or with up to
+    S3DH_DIGEST_MAX_PART_SIZES part sizes that fit the length and part count, all hashed in one pass. If
+    none fits, the ETag can not be checked by hashing and the digest is S3DH_DIGEST_UNVERIFIABLE.
+ */
+@interface S3ObjectDigest : NSObject
+
+/** Creates a digest that can be compared with etag for an object of length bytes. partSize is the part
+    size used to upload multipart objects, 0 to infer it from the ETag.
+ */
+- (id)initWithETag:(NSString*)etag length:(int64_t)length partSize:(int64_t)partSize;
+
+/** Restores a digest from a saved state, returns nil if the state is not valid.
+ */
+- (id)initWithState:(NSDictionary*)state;
+
+/** Hashes the part of the bytes that continues from hashedOffset, returns the number of bytes hashed.
+ */
+- (NSUInteger)updateWithBytes:(const void*)bytes length:(NSUInteger)length atOffset:(int64_t)offset;
+
+/** Reads the file from hashedOffset up to offset and hashes it, used when blocks complete ahead of the
+    hashed data. Returns false if the file could not be read.
+ */
+- (BOOL)updateFromFileDescriptor:(int)fd toOffset:(int64_t)offset;
+
+/** Digest of the bytes hashed so far in the same form as etag, the running state is not finalised. For a
+    multipart ETag the composite for the part size that matches is returned, or the first if none match,
+    and S3DH_DIGEST_UNVERIFIABLE if no part size fits the ETag.
+ */
+- (NSString*)digestForETag:(NSString*)etag;
+
+/** Hashes the file at path in one pass and returns the digest in the same form as etag, nil if the
+    file can not be read.
+ */
++ (NSString*)digestOfFileAtPath:(NSString*)path forETag:(NSString*)etag partSize:(int64_t)partSize;
+
+/** Number of parts encoded in a multipart ETag, 0 for a single part ETag.
+ */
++ (NSUInteger)partCountOfETag:(NSString*)etag;
+
+@property (nonatomic, readonly) int64_t     hashedOffset;       // Number of bytes hashed from the start of the object.
+@property (nonatomic, readonly) NSArray     *partSizes;         // Part sizes being hashed, empty for a single part ETag.
+@property (nonatomic, readonly) BOOL        isVerifiable;       // False for a multipart ETag that no part size fits.
+@property (nonatomic, readonly) NSDictionary *state;            // Hash state and offset for saving in a checkpoint.
+
+@end
@@ -0,0 +1,314 @@
+//
+//  S3ObjectDigest.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 19/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3ObjectDigest.h"
+#import <unistd.h>
+#import <fcntl.h>
+#import <errno.h>
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Module Definitions
+// ---------------------------------------------------------------------------------------------------------------------
+#define S3DH_MEBIBYTE 1048576
+
+// Part sizes used by the common upload tools, tried in order when the part size has to be inferred.
+static const int64_t S3DHCommonPartSizes[] = { 5, 8, 15, 16, 32, 50, 64, 100, 128, 256, 512 };
+
+// Running MD5 of one candidate part size, completed part digests are appended to digests.
+@interface S3DigestPart : NSObject
+{
+@public
+    int64_t                 _partSize;                  // Length of each part.
+    int64_t                 _partOffset;                // Bytes hashed into the current part.
+    CC_MD5_CTX              _context;                   // MD5 context of the current part.
+    NSMutableData           *_digests;                  // Raw MD5s of the completed parts.
+}
+@end
+
+@implementation S3DigestPart
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3ObjectDigest ()
+{
+    CC_MD5_CTX              _context;                   // Running MD5 context of the whole object.
+    int64_t                 _hashedOffset;              // Number of bytes hashed from the start of the object.
+    NSMutableArray          *_parts;                    // S3DigestPart for each part size, empty for a single part ETag.
+    BOOL                    _unverifiable;              // True for a multipart ETag that no part size fits.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3ObjectDigest
+
+@synthesize hashedOffset    = _hashedOffset;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)init
+{
+    return [self initWithETag: nil length: 0 partSize: 0 ];
+}
+
+- (id)initWithETag:(NSString*)etag length:(int64_t)length partSize:(int64_t)partSize
+{
+    self = [super init];
+    if( self ){
+        CC_MD5_Init( &_context );
+        _hashedOffset   = 0;
+        _parts          = [[NSMutableArray alloc] init];
+
+        for( NSNumber *size in [S3ObjectDigest partSizesForETag: etag length: length partSize: partSize] ){
+            S3DigestPart *part  = [[S3DigestPart alloc] init];
+            part->_partSize     = [size longLongValue];
+            part->_partOffset   = 0;
+            part->_digests      = [[NSMutableData alloc] init];
+            CC_MD5_Init( &part->_context );
+            [_parts addObject: part ];
+        }
+
+        // Hashing the whole object as one part could never match a multipart ETag.
+        _unverifiable   = [S3ObjectDigest partCountOfETag: etag ] > 0 && [_parts count] == 0;
+    }
+    return self;
+}
+
+- (id)initWithState:(NSDictionary*)state
+{
+    if( ! [state isKindOfClass: [NSDictionary class]] ) return nil;
+    NSData *context = [state objectForKey: @"context"];
+    if( [context length] != sizeof(CC_MD5_CTX) ) return nil;
+
+    self = [super init];
+    if( self ){
+        [context getBytes: &_context length: sizeof(CC_MD5_CTX) ];
+        _hashedOffset   = [[state objectForKey: @"offset"] longLongValue];
+        _unverifiable   = [[state objectForKey: @"unverifiable"] boolValue];
+        _parts          = [[NSMutableArray alloc] init];
+
+        for( NSDictionary *saved in [state objectForKey: @"parts"] ){
+            NSData *partContext = [saved objectForKey: @"context"];
+            NSData *digests     = [saved objectForKey: @"digests"];
+            if( [partContext length] != sizeof(CC_MD5_CTX) || [digests length] % CC_MD5_DIGEST_LENGTH ) return nil;
+
+            S3DigestPart *part  = [[S3DigestPart alloc] init];
+            part->_partSize     = [[saved objectForKey: @"size"] longLongValue];
+            part->_partOffset   = [[saved objectForKey: @"offset"] longLongValue];
+            part->_digests      = [digests mutableCopy];
+            [partContext getBytes: &part->_context length: sizeof(CC_MD5_CTX) ];
+            if( part->_partSize <= 0 || part->_partOffset < 0 || part->_partOffset >= part->_partSize ) return nil;
+            [_parts addObject: part ];
+        }
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Synthesized Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSArray*)partSizes
+{
+    NSMutableArray *sizes = [[NSMutableArray alloc] init];
+    for( S3DigestPart *part in _parts ){
+        [sizes addObject: [NSNumber numberWithLongLong: part->_partSize] ];
+    }
+    return sizes;
+}
+
+- (BOOL)isVerifiable
+{
+    return ! _unverifiable;
+}
+
+- (NSDictionary*)state
+{
+    NSMutableArray *parts = [[NSMutableArray alloc] init];
+    for( S3DigestPart *part in _parts ){
+        [parts addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+                           [NSNumber numberWithLongLong: part->_partSize],                       @"size",
+                           [NSNumber numberWithLongLong: part->_partOffset],                     @"offset",
+                           [NSData dataWithBytes: &part->_context length: sizeof(CC_MD5_CTX)],  @"context",
+                           [NSData dataWithData: part->_digests],                               @"digests", nil ] ];
+    }
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            [NSNumber numberWithLongLong: _hashedOffset],                        @"offset",
+            [NSData dataWithBytes: &_context length: sizeof(CC_MD5_CTX)],       @"context",
+            [NSNumber numberWithBool: _unverifiable],                           @"unverifiable",
+            parts,                                                              @"parts", nil ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)updateWithBytes:(const void*)bytes length:(NSUInteger)length atOffset:(int64_t)offset
+{
+    // Only bytes that straddle or start at the hashed offset can be used.
+    if( offset > _hashedOffset || offset + (int64_t)length <= _hashedOffset ) return 0;
+
+    NSUInteger skip     = (NSUInteger)( _hashedOffset - offset );
+    NSUInteger count    = length - skip;
+    [self hashBytes: (const uint8_t*)bytes + skip length: count ];
+    return count;
+}
+
+- (BOOL)updateFromFileDescriptor:(int)fd toOffset:(int64_t)offset
+{
+    if( fd < 0 ) return false;
+
+    uint8_t *buffer = malloc( S3DH_DIGEST_READ_SIZE );
+    if( ! buffer ) return false;
+
+    BOOL result = true;
+    while( _hashedOffset < offset ){
+        size_t want     = (size_t)MIN( (int64_t)S3DH_DIGEST_READ_SIZE, offset - _hashedOffset );
+        ssize_t got     = pread( fd, buffer, want, (off_t)_hashedOffset );
+        if( got < 0 && errno == EINTR ) continue;
+        if( got <= 0 ){
+            result = false;
+            break;
+        }
+        [self hashBytes: buffer length: (NSUInteger)got ];
+    }
+    free( buffer );
+    return result;
+}
+
+- (NSString*)digestForETag:(NSString*)etag
+{
+    if( _unverifiable ) return S3DH_DIGEST_UNVERIFIABLE;
+    if( [_parts count] == 0 ){
+        // Finalise a copy so that the running context can continue to be updated.
+        CC_MD5_CTX context = _context;
+        unsigned char digest[CC_MD5_DIGEST_LENGTH];
+        CC_MD5_Final( digest, &context );
+        return [S3ObjectDigest hexString: digest ];
+    }
+
+    NSString *first = nil;
+    for( S3DigestPart *part in _parts ){
+        NSString *composite = [self compositeDigestOfPart: part ];
+        if( [composite isEqualToString: etag] ) return composite;
+        if( ! first ) first = composite;
+    }
+    return first;
+}
+
++ (NSString*)digestOfFileAtPath:(NSString*)path forETag:(NSString*)etag partSize:(int64_t)partSize
+{
+    int fd = open( [path fileSystemRepresentation], O_RDONLY );
+    if( fd < 0 ) return nil;
+
+    off_t length = lseek( fd, 0, SEEK_END );
+    S3ObjectDigest *digest = [[S3ObjectDigest alloc] initWithETag: etag length: MAX( (int64_t)length, 0 ) partSize: partSize ];
+    BOOL read = ( length >= 0 ) && [digest updateFromFileDescriptor: fd toOffset: (int64_t)length ];
+    close( fd );
+
+    return read ? [digest digestForETag: etag ] : nil;
+}
+
++ (NSUInteger)partCountOfETag:(NSString*)etag
+{
+    NSRange dash = [etag rangeOfString: @"-" options: NSBackwardsSearch ];
+    if( dash.location == NSNotFound ) return 0;
+
+    NSString *suffix = [etag substringFromIndex: dash.location + 1 ];
+    if( [suffix length] == 0 ||
+        [suffix rangeOfCharacterFromSet: [[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location != NSNotFound ){
+        return 0;
+    }
+    return (NSUInteger)[suffix integerValue];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Feeds contiguous bytes to the whole object context, or to every part size splitting the bytes at part boundaries.
+- (void)hashBytes:(const uint8_t*)bytes length:(NSUInteger)length
+{
+    if( [_parts count] == 0 ){
+        CC_MD5_Update( &_context, bytes, (CC_LONG)length );
+    }
+    for( S3DigestPart *part in _parts ){
+        NSUInteger done = 0;
+        while( done < length ){
+            NSUInteger count = (NSUInteger)MIN( (int64_t)( length - done ), part->_partSize - part->_partOffset );
+            CC_MD5_Update( &part->_context, bytes + done, (CC_LONG)count );
+            part->_partOffset  += count;
+            done               += count;
+
+            if( part->_partOffset == part->_partSize ){
+                unsigned char digest[CC_MD5_DIGEST_LENGTH];
+                CC_MD5_Final( digest, &part->_context );
+                [part->_digests appendBytes: digest length: CC_MD5_DIGEST_LENGTH ];
+                CC_MD5_Init( &part->_context );
+                part->_partOffset = 0;
+            }
+        }
+    }
+    _hashedOffset += length;
+}
+
+// MD5 of the concatenated part MD5s with the part count appended, as S3 reports it for multipart uploads.
+- (NSString*)compositeDigestOfPart:(S3DigestPart*)part
+{
+    NSMutableData *digests = [part->_digests mutableCopy];
+    if( part->_partOffset > 0 ){
+        CC_MD5_CTX context = part->_context;
+        unsigned char digest[CC_MD5_DIGEST_LENGTH];
+        CC_MD5_Final( digest, &context );
+        [digests appendBytes: digest length: CC_MD5_DIGEST_LENGTH ];
+    }
+
+    unsigned char composite[CC_MD5_DIGEST_LENGTH];
+    CC_MD5( [digests bytes], (CC_LONG)[digests length], composite );
+    return [NSString stringWithFormat: @"%@-%lu", [S3ObjectDigest hexString: composite ],
+            (unsigned long)( [digests length] / CC_MD5_DIGEST_LENGTH ) ];
+}
+
+// Part sizes that split length into the number of parts in etag, the configured size is only used if it fits.
++ (NSArray*)partSizesForETag:(NSString*)etag length:(int64_t)length partSize:(int64_t)partSize
+{
+    int64_t count = (int64_t)[S3ObjectDigest partCountOfETag: etag ];
+    NSMutableArray *sizes = [[NSMutableArray alloc] init];
+    if( count == 0 ) return sizes;
+
+    NSMutableArray *candidates = [[NSMutableArray alloc] init];
+    if( partSize > 0 ) [candidates addObject: [NSNumber numberWithLongLong: partSize] ];
+    for( NSUInteger i = 0; i < sizeof(S3DHCommonPartSizes) / sizeof(S3DHCommonPartSizes[0]); i++ ){
+        [candidates addObject: [NSNumber numberWithLongLong: S3DHCommonPartSizes[i] * S3DH_MEBIBYTE] ];
+    }
+    // Tools that split evenly use the length over the part count, often rounded up to a whole mebibyte.
+    int64_t even = ( length + count - 1 ) / count;
+    [candidates addObject: [NSNumber numberWithLongLong: ( ( even + S3DH_MEBIBYTE - 1 ) / S3DH_MEBIBYTE ) * S3DH_MEBIBYTE] ];
+    [candidates addObject: [NSNumber numberWithLongLong: even] ];
+
+    for( NSNumber *candidate in candidates ){
+        int64_t size = [candidate longLongValue];
+        if( size <= 0 || ( length + size - 1 ) / size != count || [sizes containsObject: candidate] ) continue;
+        [sizes addObject: candidate ];
+        if( [sizes count] == S3DH_DIGEST_MAX_PART_SIZES ) break;
+    }
+    return sizes;
+}
+
++ (NSString*)hexString:(const unsigned char*)digest
+{
+    NSMutableString *hex = [NSMutableString stringWithCapacity: CC_MD5_DIGEST_LENGTH * 2 ];
+    for( int i = 0; i < CC_MD5_DIGEST_LENGTH; i++ ){
+        [hex appendFormat: @"%02x", digest[i] ];
+    }
+    return hex;
+}
+
+@end
@@ -0,0 +1,69 @@
+//
+//  S3ProgressReporter.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 23/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3TransferEngine;
+@class S3RequestHelper;
+
+#define S3DH_PROGRESS_RATE 4.0              // Most progress snapshots delivered per second.
+
+/** Progress of every object of a bucket at one moment. Totals cover all objects, objectBytes only holds
+    the objects whose byte count changed since the previous snapshot.
+ */
+@interface S3ProgressSnapshot : NSObject
+
+@property (nonatomic, readonly) NSTimeInterval      timestamp;          // Reference time the snapshot was taken.
+@property (nonatomic, readonly) int64_t             bytesTransferred;   // Bytes downloaded across all objects.
+@property (nonatomic, readonly) int64_t             bytesTotal;         // Size of all objects.
+@property (nonatomic, readonly) NSUInteger          objectsTransferred; // Objects downloaded or saved.
+@property (nonatomic, readonly) NSUInteger          objectsTotal;       // Number of objects.
+@property (nonatomic, readonly) double              throughput;         // Bytes per second since the previous snapshot.
+@property (nonatomic, readonly) NSDictionary        *objectBytes;       // Key to NSNumber bytes transferred, changed objects only.
+
+@end
+
+/** Publishes the progress of a set of S3RequestHelpers as S3ProgressSnapshots at no more than rate per
+    second. Totals are kept as helpers are added, removed and read, so each tick only reads the helpers
+    that are downloading and its cost does not grow with the number of objects or the data received. A
+    snapshot is only delivered when something changed. The reporter stops ticking once no helper is
+    downloading and must be started again. All methods must be called on the engine thread and the
+    handler is called on the engine thread.
+ */
+@interface S3ProgressReporter : NSObject
+
+/** Creates a reporter that reads the downloading helpers returned by helpers on each tick and passes each
+    snapshot to handler. Only helpers that have been added are read.
+ */
+- (id)initWithEngine:(S3TransferEngine*)engine rate:(double)rate helpers:(NSArray* (^)(void))helpers handler:(void (^)(S3ProgressSnapshot *snapshot))handler;
+
+/** Starts ticking if the reporter is stopped.
+ */
+- (void)start;
+
+/** Stops ticking, a snapshot is not delivered for changes since the last tick.
+ */
+- (void)stop;
+
+/** Counts a helper in the totals, its progress so far is read at once.
+ */
+- (void)addHelper:(S3RequestHelper*)helper;
+
+/** Takes a helper out of the totals.
+ */
+- (void)removeHelper:(S3RequestHelper*)helper;
+
+/** Reads a helper that is not downloading, call when a helper finishes, fails, is reset or is suspended so the
+    totals follow it. The change is delivered with the next snapshot.
+ */
+- (void)updateHelper:(S3RequestHelper*)helper;
+
+@property (nonatomic, assign)   double              rate;               // Most snapshots per second, takes effect on the next start.
+@property (nonatomic, readonly) BOOL                isRunning;          // True while the reporter is ticking.
+
+@end
@@ -0,0 +1,213 @@
+//
+//  S3ProgressReporter.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 23/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3ProgressReporter.h"
+#import "S3TransferEngine.h"
+#import "S3RequestHelper.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3ProgressSnapshot ()
+{
+@public
+    NSTimeInterval          _timestamp;
+    int64_t                 _bytesTransferred;
+    int64_t                 _bytesTotal;
+    NSUInteger              _objectsTransferred;
+    NSUInteger              _objectsTotal;
+    double                  _throughput;
+    NSDictionary            *_objectBytes;
+}
+@end
+
+// Values of a helper when it was last read.
+@interface S3ProgressEntry : NSObject
+{
+@public
+    int64_t                 _bytes;                     // Bytes transferred.
+    int64_t                 _size;                      // Size of the object.
+    BOOL                    _complete;                  // True once the object is downloaded or saved.
+}
+@end
+
+@interface S3ProgressReporter ()
+{
+    S3TransferEngine        *_engine;                   // Engine the tick timer runs on.
+    double                  _rate;                      // Most snapshots per second.
+    NSArray*                (^_helpers)(void);          // Returns the downloading helpers to read on each tick.
+    void                    (^_handler)(S3ProgressSnapshot*);   // Receives each snapshot.
+
+    NSTimer                 *_timer;                    // Tick timer, nil when stopped.
+    NSMutableDictionary     *_entries;                  // Key to S3ProgressEntry of each added helper.
+    NSMutableDictionary     *_changed;                  // Key to NSNumber bytes transferred, changed since the previous snapshot.
+    int64_t                 _bytesTransferred;          // Bytes transferred across the added helpers.
+    int64_t                 _bytesTotal;                // Size of the added helpers.
+    NSUInteger              _objectsTransferred;        // Added helpers downloaded or saved.
+    BOOL                    _countsChanged;             // True once a helper was added or removed since the previous snapshot.
+    int64_t                 _lastTransferred;           // Total bytes transferred at the previous snapshot.
+    NSTimeInterval          _lastTimestamp;             // Reference time of the previous snapshot.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3ProgressSnapshot
+
+@synthesize timestamp           = _timestamp;
+@synthesize bytesTransferred    = _bytesTransferred;
+@synthesize bytesTotal          = _bytesTotal;
+@synthesize objectsTransferred  = _objectsTransferred;
+@synthesize objectsTotal        = _objectsTotal;
+@synthesize throughput          = _throughput;
+@synthesize objectBytes         = _objectBytes;
+
+@end
+
+@implementation S3ProgressEntry
+@end
+
+@implementation S3ProgressReporter
+
+@synthesize rate            = _rate;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithEngine:(S3TransferEngine*)engine rate:(double)rate helpers:(NSArray* (^)(void))helpers handler:(void (^)(S3ProgressSnapshot *snapshot))handler
+{
+    self = [super init];
+    if( self ){
+        _engine         = engine;
+        _rate           = rate;
+        _helpers        = [helpers copy];
+        _handler        = [handler copy];
+        _entries        = [[NSMutableDictionary alloc] init];
+        _changed        = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_timer invalidate];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Synthesized Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (BOOL)isRunning
+{
+    return _timer != nil;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)start
+{
+    if( _timer || _rate <= 0 ) return;
+
+    _lastTimestamp  = [NSDate timeIntervalSinceReferenceDate];
+    __weak S3ProgressReporter *weakSelf = self;
+    _timer          = [_engine scheduledTimerWithTimeInterval: 1.0 / _rate repeats: YES block:^(NSTimer *timer) {
+        [weakSelf tick: timer ];
+    }];
+}
+
+- (void)stop
+{
+    [_timer invalidate];
+    _timer = nil;
+}
+
+- (void)addHelper:(S3RequestHelper*)helper
+{
+    if( ! helper.key || [_entries objectForKey: helper.key] ) return;
+
+    [_entries setObject: [[S3ProgressEntry alloc] init] forKey: helper.key ];
+    _countsChanged = true;
+    [self readHelper: helper ];
+}
+
+- (void)removeHelper:(S3RequestHelper*)helper
+{
+    S3ProgressEntry *entry = helper.key ? [_entries objectForKey: helper.key] : nil;
+    if( ! entry ) return;
+
+    _bytesTransferred   -= entry->_bytes;
+    _bytesTotal         -= entry->_size;
+    if( entry->_complete ) _objectsTransferred -= 1;
+    [_entries removeObjectForKey: helper.key ];
+    [_changed removeObjectForKey: helper.key ];
+    _countsChanged = true;
+}
+
+- (void)updateHelper:(S3RequestHelper*)helper
+{
+    [self readHelper: helper ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Applies the change of one helper since it was last read to the totals.
+- (void)readHelper:(S3RequestHelper*)helper
+{
+    S3ProgressEntry *entry = helper.key ? [_entries objectForKey: helper.key] : nil;
+    if( ! entry ) return;
+
+    int64_t bytes       = helper.bytesTransferred;
+    int64_t size        = helper.fileSize;
+    BOOL complete       = helper.state == TRANSFERED || helper.state == SAVED;
+
+    if( bytes != entry->_bytes ) [_changed setObject: [NSNumber numberWithLongLong: bytes] forKey: helper.key ];
+    if( complete != entry->_complete ) _objectsTransferred += complete ? 1 : -1;
+
+    _bytesTransferred   += bytes - entry->_bytes;
+    _bytesTotal         += size - entry->_size;
+    entry->_bytes       = bytes;
+    entry->_size        = size;
+    entry->_complete    = complete;
+}
+
+// Reads the downloading helpers, delivers a snapshot if anything changed and stops once nothing is downloading.
+- (void)tick:(NSTimer*)timer
+{
+    BOOL downloading = false;
+    for( S3RequestHelper *s3rh in _helpers() ){
+        [self readHelper: s3rh ];
+        if( s3rh.state == DOWNLOADING ) downloading = true;
+    }
+
+    if( ! downloading ) [self stop];
+    if( [_changed count] == 0 && ! _countsChanged ) return;
+
+    NSTimeInterval now              = [NSDate timeIntervalSinceReferenceDate];
+    NSTimeInterval elapsed          = now - _lastTimestamp;
+    S3ProgressSnapshot *snapshot    = [[S3ProgressSnapshot alloc] init];
+    snapshot->_timestamp            = now;
+    snapshot->_bytesTransferred     = _bytesTransferred;
+    snapshot->_bytesTotal           = _bytesTotal;
+    snapshot->_objectsTransferred   = _objectsTransferred;
+    snapshot->_objectsTotal         = [_entries count];
+    snapshot->_objectBytes          = _changed;
+    snapshot->_throughput           = ( elapsed > 0 && _bytesTransferred > _lastTransferred )
+                                    ? ( _bytesTransferred - _lastTransferred ) / elapsed : 0;
+
+    _changed                        = [[NSMutableDictionary alloc] init];
+    _countsChanged                  = false;
+    _lastTransferred                = _bytesTransferred;
+    _lastTimestamp                  = now;
+
+    if( _handler ) _handler( snapshot );
+}
+
+@end
@@ -11,10 +11,24 @@
 
 @class AmazonS3Client;
 @class S3ObjectSummary;
-
-#define DEFAULT_RETRY_LIMIT 3           // Number of consecutive attempts at downloading.
-#define DOWNLOAD_BLOCK_SIZE 1048576     // Number of bytes to try and download at one time.
-#define TIME_OUT_INTERVAL 30            // Number of seconds a download will try before cancelling a block and restarting.
+@class S3BlockSizer;
+@class S3TransferEngine;
+@class S3RetryPolicy;
+@class S3LatencyTracker;
+@class S3StallDetector;
+@class S3BandwidthLimiter;
+@class S3SyncManifest;
+
+#define DEFAULT_RETRY_LIMIT 3               // Number of consecutive failed blocks retried before the download fails.
+#define DOWNLOAD_BLOCK_SIZE 1048576         // Number of bytes to try and download at one time, before throughput is measured.
+#define DOWNLOAD_MIN_BLOCK_SIZE 262144      // Smallest block the adaptive sizing will request, also the block map granularity.
+#define DOWNLOAD_MAX_BLOCK_SIZE 16777216    // Largest block the adaptive sizing will request.
+#define DOWNLOAD_BLOCK_DURATION 5.0         // Number of seconds the adaptive sizing aims for each block to take.
+#define DEFAULT_PARALLEL_RANGES 4           // Number of block requests kept in flight for a single object.
+#define DEFAULT_PREFETCH_DEPTH 1            // Number of extra block requests issued while earlier blocks are streaming.
+#define CHECKPOINT_INTERVAL 5.0             // Seconds between saves of the completed block list for resuming a download.
+#define DEFAULT_HEDGE_PERCENTILE 0.95       // Block duration percentile after which a duplicate request is raced against a block.
+#define DEFAULT_SMALL_OBJECT_SIZE 262144    // Objects smaller than this are fetched with a single GET and saved straight to the persist path.
 
 enum S3DHErrorCodes {
     S3DH_RHELPER_SUCCESS = 0,         // Default Code if there is no error.
@@ -22,7 +36,7 @@ enum S3DHErrorCodes {
     S3DH_RHELPER_NIL_BUCKET,
     S3DH_RHELPER_NIL_DELEGATE,
     S3DH_RHELPER_NIL_SUMMARY,
-    S3DH_RHELPER_FILE_UNWRITABLE,     // Reset method can't confirm writtability to specified location.
+    S3DH_RHELPER_FILE_UNWRITABLE,     // Download location can't be written or space for the file can't be reserved.
     S3DH_RHELPER_FILE_CREATE_FAIL,
     S3DH_RHELPER_FILE_INIT_FAIL,
     S3DH_RHELPER_FOLDER_FAIL,
@@ -30,11 +44,14 @@ enum S3DHErrorCodes {
     S3DH_RHELPER_FILE_PERSIST_FAIL,
     S3DH_RHELPER_FILE_DL_OVERRUN,
     S3DH_RHELPER_DOWNLOAD_ERROR,
-    S3DH_RHELPER_RETRY_EXCEEDED
+    S3DH_RHELPER_RETRY_EXCEEDED,
+    S3DH_RHELPER_OBJECT_CHANGED,      // The object ETag no longer matches the listing, the bucket list must be refreshed.
+    S3DH_RHELPER_SIZE_MISMATCH        // The object length reported by S3 can not be reconciled with the listed size.
 };
 
 typedef enum{
     INITIALISED,
+    VERIFYING,                        // Hashing a file left by an earlier download on the file pool, settles on the engine.
     DOWNLOADING,
     SUSPENDED,
     FAILED,
@@ -56,19 +73,25 @@ typedef enum{
 /// @name Download Control Methods
 ///---------------------------------------------------------------------------------------
 
-/** Used by the controlling delegate to Suspend a download, not more data will be saved, download is fired if the block completes.
-    If the delegates downloadEnable is true when download is fired, the download will auto-restart, if it is false the download will
-    remain SUSPENDED.
+/** Used by the controlling delegate to Suspend a download, the block requests in flight are cancelled and no more data will be
+    saved. The download remains SUSPENDED until synchronise is called again. If called off the engine thread the suspend is queued
+    on the engine and the method returns true.
  */
 - (BOOL)suspend;
 
-/** Resets a download from any state to initialised, all files will be deleted and all variables reset to initial conditions. Use
+/** Resets a download from any state to initialised, invalid files will be deleted and all variables reset to initial conditions. Use
     this method if the download is in the FAILED state prior to calling the download method, or to stop a currently active download.
+    If a checkpoint from an earlier download of the same ETag is found next to the download file, the partial download is kept and
+    the helper is left SUSPENDED so that synchronise continues from the blocks that completed. A persisted or download file that
+    has to be hashed to be trusted leaves the helper VERIFYING while the hash runs on the engine's file pool, the reset finishes
+    on the engine and the delegate's verificationFinished: is called once the helper has settled. Once the download has been
+    started this method must be called on the engine thread.
  */
 - (BOOL)reset;
 
-/** Starts the download if it is not currently active, if the download has been SUSPENDED and the block has not completed, this method
-    will not restart the download.
+/** Starts the download if it is not currently active, or restarts a SUSPENDED download from the blocks that have not completed.
+    All requests are issued on the engine thread, if called from any other thread the start is queued on the engine and the method
+    returns true.
  */
 - (BOOL)synchronise;
 
@@ -84,10 +107,100 @@ typedef enum{
 /// @name Properties
 ///---------------------------------------------------------------------------------------
 
+/** Transfer engine used to issue requests and receive their callbacks, defaults to the shared engine. Must be set before the
+    download is started.
+ */
+@property (nonatomic, strong) S3TransferEngine        *engine;
+
+/** Backoff and retry budget applied when a block fails, shared with the other helpers of the bucket so a bucket wide outage drains
+    one budget. Failed blocks are retried after a jittered backoff, the download fails once DEFAULT_RETRY_LIMIT consecutive blocks
+    have failed or the budget is empty. Defaults to a policy private to the helper.
+ */
+@property (nonatomic, strong) S3RetryPolicy           *retryPolicy;
+
+/** Durations of recently completed blocks and the hedge allowance, shared with the other helpers of the bucket. A block still
+    running after the DEFAULT_HEDGE_PERCENTILE duration of blocks its size is hedged with a duplicate request for the same range, the
+    first to complete is kept and the other cancelled. At most the tracker's hedgeRatio of the block requests of every helper
+    sharing it are hedged. Defaults to a tracker private to the helper.
+ */
+@property (nonatomic, strong) S3LatencyTracker        *latencyTracker;
+
+/** Decides when a block in flight has stalled, from the time to the response headers, the time to the first body byte and the
+    throughput of the body over a window. Stalled blocks are cancelled and retried. Defaults to a detector with the S3DH_STALL
+    thresholds.
+ */
+@property (nonatomic, strong) S3StallDetector         *stallDetector;
+
+/** Token bucket shared with the other helpers of the bucket that caps their combined bandwidth, each block request reserves its
+    length from the limiter before it is issued and waits if the bucket is empty. If nil, requests are issued without a limit.
+ */
+@property (nonatomic, strong) S3BandwidthLimiter      *bandwidthLimiter;
+
+/** On-disk record of the files saved for the bucket, shared with the other helpers of the bucket. Reset treats the persisted file as
+    current if its entry matches the listed ETag and size and the file still has the recorded inode, modification time and size, so
+    only files without an entry or that changed on disk are hashed. Each saved file is recorded. Defaults to the manifest of the
+    delegate if it has one, if nil files are checked by the ETag attribute stamped on them, or hashed.
+ */
+@property (nonatomic, strong) S3SyncManifest          *manifest;
+
+/** Objects smaller than this many bytes skip the block requests, download file and checkpoints. The whole object is fetched with
+    one un-ranged GET into memory, checked against md5 and written atomically to the persist path, leaving the helper SAVED.
+    Zero byte objects are created without a request. Defaults to DEFAULT_SMALL_OBJECT_SIZE, 0 sends every object through blocks.
+ */
+@property (nonatomic, assign) int64_t                 smallObjectThreshold;
+
+/** Number of ranged block requests the helper keeps in flight for this object at once, each block is
+    written into its own offset of the download file so blocks may complete in any order. Set to 1 to
+    download the object one block at a time. Defaults to DEFAULT_PARALLEL_RANGES.
+ */
+@property (nonatomic, assign) NSUInteger              parallelRanges;
+
+/** Extra ranges lent to this object by transfer slots that have nothing else to download, on top of parallelRanges. Set by the
+    S3TransferScheduler near the end of a sync so the last large objects are fetched on several streams, and returned to 0 once
+    other objects are waiting. Must be set on the engine thread.
+ */
+@property (nonatomic, assign) NSUInteger              borrowedRanges;
+
+/** Bytes of the object that no block request has claimed yet, the work an idle transfer slot can take on.
+ */
+@property (nonatomic, readonly) int64_t               bytesUnrequested;
+
+/** Adaptive block sizing for this object, the size of each new block request is chosen from the measured
+    throughput and time to first byte of the previous blocks. The minBlockSize, maxBlockSize and
+    targetDuration of the sizer can be changed at any time, block sizes are rounded down to a multiple
+    of DOWNLOAD_MIN_BLOCK_SIZE.
+ */
+@property (nonatomic, readonly) S3BlockSizer          *blockSizer;
+
+/** Number of extra block requests issued ahead of the blocks that are already streaming, the request for the next range is sent as
+    soon as an earlier block receives its response so the link does not sit idle for a round trip between blocks. Blocks are
+    always requested in file order and committed in file order. Defaults to DEFAULT_PREFETCH_DEPTH, 0 disables prefetch.
+ */
+@property (nonatomic, assign) NSUInteger              prefetchDepth;
+
+/** Part size the object was uploaded with if it was uploaded in parts, used to rebuild the md5-N ETag from the part MD5s. Defaults to
+    the delegate's multipartPartSize if it has one, otherwise 0, which infers the part size from the ETag part count and the sizes
+    the common upload tools use. Setting it after the helper is created does not recheck a persisted file.
+ */
+@property (nonatomic, assign) int64_t                 multipartPartSize;
+
+/** Number of bytes from the start of the download file that have been committed, every block before this offset is complete.
+ */
+@property (nonatomic, readonly) int64_t               committedLength;
+
 /** Reports download progress in percent complete.
  */
 @property (nonatomic, readonly) int                   progress;
 
+/** Size of the object in bytes, from the bucket listing.
+ */
+@property (nonatomic, readonly) int64_t               fileSize;
+
+/** Bytes of the object downloaded, the full size once the download is TRANSFERED or SAVED. Read by the S3ProgressReporter of the
+    bucket rather than reported per chunk.
+ */
+@property (nonatomic, readonly) int64_t               bytesTransferred;
+
 /** Reports the state of the download item, options are:
     INITIALISED  - RequestHelper successfully initialised but download not started.
     DOWNLOADING  - RequestHelper downloading file, download not yet complete see progress property.
@@ -106,6 +219,11 @@ typedef enum{
  */
 @property (nonatomic, readonly) NSString              *md5;
 
+/** MD5 of the downloaded data, hashed from the bytes as they stream in, in the md5-N form for objects uploaded in parts. Nil until
+    every byte of the object has been hashed, the delegate can compare it with md5 to validate a download without reading the file back.
+ */
+@property (nonatomic, readonly) NSString              *downloadDigest;
+
 /** Temporary file path for the object to download the specified AWS file to, this path is controlled by the downloadPath method in 
     the S3RequestHelperDelegateProtocol.
  */
@@ -8,13 +8,33 @@
 
 #import "S3RequestHelper.h"
 #import "S3SyncHelper.h"
+#import "S3BlockMap.h"
+#import "S3BlockRequest.h"
+#import "S3BlockOutputStream.h"
+#import "S3BlockSizer.h"
+#import "S3TransferEngine.h"
+#import "S3FileWriter.h"
+#import "S3ObjectDigest.h"
+#import "S3RetryPolicy.h"
+#import "S3LatencyTracker.h"
+#import "S3StallDetector.h"
+#import "S3BandwidthLimiter.h"
+#import "S3SyncManifest.h"
 #import <AWSRuntime/AWSRuntime.h>
 #import <AWSS3/AmazonS3Client.h>
+#import <sys/xattr.h>
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Module Definitions
 // ---------------------------------------------------------------------------------------------------------------------
 #define S3DH_REQUEST_HELPER_DOMAIN @"co.c-works.s3dh.requesthelper"
+#define S3DH_ETAG_XATTR "co.c-works.s3dh.etag"              // Extended attribute holding the ETag a persisted file was saved from.
+
+typedef enum{
+    S3DH_PERSIST_STALE,                                     // No copy of the listed version at the persist path.
+    S3DH_PERSIST_CURRENT,                                   // The persisted file is the listed version.
+    S3DH_PERSIST_UNCHECKED                                  // The persisted file has to be hashed to tell.
+} S3DH_PERSIST_CHECK;
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Interface Definition
@@ -31,19 +51,43 @@
 
     NSString                *_downloadPath;             // Temporary file path to download file to.
     NSString                *_persistPath;              // Permanent file path to persist file to.
-    NSOutputStream          *_outputStream;             // Filestream for the downloaded file request.
+    S3FileWriter            *_fileWriter;               // Positional file writer shared by the block streams of this download.
 
     int                     _attempts;                  // Counts failed attempts since last reset.
     int                     _progress;                  // Defines the current download progress 0-100%.
     REQUEST_STATE           _state;                     // Defines the download state of the object.
-    Boolean                 _blockComplete;             // Indicates if the current block is complete or not.
-    NSTimer                 *_timeOut;                   // Time-out timer used for restarting download.
 
-    NSUInteger              _fileSize;                  // Filesize reported by Amazon for this file.
-    NSUInteger              _dataTransfered;            // Total data streamed into the open file.
-    NSUInteger              _blockRequestEnd;           // End of the last block requested.
+    int64_t                 _fileSize;                  // Filesize reported by Amazon for this file.
+    int64_t                 _reportedSize;              // Length the first response reported if the listing was wrong, -1 if not.
+    int64_t                 _dataTransfered;            // Total data streamed into the open file.
+    NSUInteger              _parallelRanges;            // Maximum number of block requests in flight at once.
+    NSUInteger              _prefetchDepth;             // Extra block requests issued while earlier blocks stream.
+    NSUInteger              _borrowedRanges;            // Extra block requests lent by idle transfer slots.
+    int64_t                 _committedLength;           // Bytes from the start of file covered by completed blocks.
+    NSString                *_checkpointPath;           // File the completed block list is saved to for resuming.
+    S3ObjectDigest          *_digest;                   // Running MD5 of the downloaded data in file order.
+    int64_t                 _multipartPartSize;         // Part size of multipart uploads, 0 to infer from the ETag.
+    NSTimeInterval          _lastCheckpoint;            // Reference time the checkpoint was last saved.
+
+    S3BlockMap              *_blockMap;                 // Bitmap of requested and completed blocks for this download.
+    S3BlockSizer            *_blockSizer;               // Chooses the size of each block from measured throughput.
+    S3TransferEngine        *_engine;                   // Engine whose event loop issues requests and receives callbacks.
+    S3RetryPolicy           *_retryPolicy;              // Backoff and retry budget, shared by the bucket.
+    NSTimeInterval          _retryAfter;                // Reference time before which no blocks are requested, 0 if not backing off.
+    S3LatencyTracker        *_latencyTracker;           // Recent block durations, shared by the bucket.
+    S3StallDetector         *_stallDetector;            // Decides when a block in flight has stalled.
+    NSTimer                 *_stallTimer;               // Engine timer that checks the blocks in flight, nil when idle.
+    S3BandwidthLimiter      *_bandwidthLimiter;         // Bandwidth cap the block requests reserve their bytes from, shared by the bucket.
+    S3SyncManifest          *_manifest;                 // Record of the files saved for the bucket, shared by the bucket.
+    NSString                *_persistedETag;            // ETag of an intact persisted copy of another version, nil if none.
+    NSString                *_verifyingPath;            // File being hashed on the file pool while VERIFYING, nil if none.
+    NSUInteger              _verification;              // Counts verifications started, a result for an earlier one is ignored.
+    NSMutableArray          *_activeBlocks;             // S3BlockRequest objects currently in flight.
 
-    S3GetObjectRequest      *_getObjectRequest;         // Pointer to hold the active request for this download.
+    int64_t                 _smallObjectThreshold;      // Objects smaller than this are fetched whole with a single GET.
+    S3GetObjectRequest      *_objectRequest;            // Un-ranged request of a small object, nil when none is in flight.
+    S3BandwidthReservation  *_objectReservation;        // Bandwidth reserved for the small object request.
+    NSMutableData           *_objectData;               // Body of the small object received so far.
 
     NSError                 *_error;                    // Error, if reported by S3GetObjectRequest for this file.
     NSException             *_exception;                // Exception, if reported by the S3GetObjectRequest for this file.
@@ -58,7 +102,21 @@
 // ---------------------------------------------------------------------------------------------------------------------
 // Synthesized Getters & Setters
 // ---------------------------------------------------------------------------------------------------------------------
+@synthesize parallelRanges  = _parallelRanges;          // Synthesized to allow the helper to tune concurrency per object.
+@synthesize prefetchDepth   = _prefetchDepth;           // Synthesized to allow the helper to tune pipelining per object.
+@synthesize borrowedRanges  = _borrowedRanges;          // Synthesized to allow the scheduler to lend idle slots to an object.
+@synthesize smallObjectThreshold = _smallObjectThreshold; // Synthesized to allow the helper to tune the single GET path.
+@synthesize committedLength = _committedLength;         // Synthesized to allow the helper to report in order progress.
+@synthesize multipartPartSize = _multipartPartSize;     // Synthesized to allow the helper to match its upload tool.
+@synthesize blockSizer      = _blockSizer;              // Synthesized to allow the helper to tune block sizes per object.
+@synthesize engine          = _engine;                  // Synthesized to allow the helper to share an engine between objects.
+@synthesize retryPolicy     = _retryPolicy;             // Synthesized to allow the helper to share a retry budget between objects.
+@synthesize latencyTracker  = _latencyTracker;          // Synthesized to allow the helper to share block durations between objects.
+@synthesize stallDetector   = _stallDetector;           // Synthesized to allow the helper to tune stall thresholds per object.
+@synthesize bandwidthLimiter = _bandwidthLimiter;       // Synthesized to allow the helper to share a bandwidth cap between objects.
+@synthesize manifest        = _manifest;                // Synthesized to allow the helper to share a manifest between objects.
 @synthesize progress        = _progress;                // Synthesized to allow reporting of the status to the user.
+@synthesize fileSize        = _fileSize;                // Synthesized to allow progress totals across objects.
 @synthesize state           = _state;                   // Synthesized to allow the helper to determine next action.
 @synthesize key             = _key;                     // Syntehsized to allow the helper to determine the file paths.
 @synthesize md5             = _md5;                     // Syntehsized to allow the helper to validate downloads md5.
@@ -69,6 +127,35 @@
 @synthesize error           = _error;                   // Synthesized to allow helper to make decisions about next action.
 @synthesize exception       = _exception;               // Synthesized to allow helper to make decisions about next action.
 
+// Downloaded and saved objects are complete whatever was streamed in this session.
+-(int64_t)bytesTransferred{
+    if( _state == TRANSFERED || _state == SAVED ) return _fileSize;
+    return _dataTransfered;
+}
+
+// Only reports a digest once the whole object has been hashed, a partial digest can never match the listed md5.
+-(NSString*)downloadDigest{
+    if( ! _digest || _digest.hashedOffset != _fileSize ) return nil;
+    return [_digest digestForETag: _md5 ];
+}
+
+// Issues the extra ranges straight away, ranges taken back are simply not reissued as their blocks complete.
+-(void)setBorrowedRanges:(NSUInteger)borrowedRanges{
+    _borrowedRanges = borrowedRanges;
+    if( _state == DOWNLOADING ) [self requestBlocks];
+}
+
+-(int64_t)bytesUnrequested{
+    if( _state == TRANSFERED || _state == SAVED || ! _blockMap || [self isSmallObject] ) return 0;
+    return MIN( (int64_t)_blockMap.unrequestedBlocks * DOWNLOAD_MIN_BLOCK_SIZE, _fileSize );
+}
+
+// Rebuilds the digest for the new part size if nothing has been hashed with the old one yet.
+-(void)setMultipartPartSize:(int64_t)multipartPartSize{
+    _multipartPartSize = multipartPartSize;
+    if( _md5 && _digest.hashedOffset == 0 ) _digest = [self emptyDigest];
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Initialisation Methods
 // ---------------------------------------------------------------------------------------------------------------------
@@ -82,6 +169,19 @@
     {
         _error              = e;
         _state              = INITIALISED;
+        _reportedSize       = -1;
+        _parallelRanges     = DEFAULT_PARALLEL_RANGES;
+        _prefetchDepth      = DEFAULT_PREFETCH_DEPTH;
+        _smallObjectThreshold = DEFAULT_SMALL_OBJECT_SIZE;
+        _activeBlocks       = [[NSMutableArray alloc] init];
+        _engine             = [S3TransferEngine sharedEngine];
+        _retryPolicy        = [[S3RetryPolicy alloc] init];
+        _latencyTracker     = [[S3LatencyTracker alloc] init];
+        _stallDetector      = [[S3StallDetector alloc] init];
+        _blockSizer         = [[S3BlockSizer alloc] initWithBlockSize: DOWNLOAD_BLOCK_SIZE
+                                                         minBlockSize: DOWNLOAD_MIN_BLOCK_SIZE
+                                                         maxBlockSize: DOWNLOAD_MAX_BLOCK_SIZE
+                                                       targetDuration: DOWNLOAD_BLOCK_DURATION ];
         
         if ( !( _client     = c ) ) {
             [self error:S3DH_RHELPER_NIL_CLIENT data:nil error: &e ];
@@ -102,78 +202,140 @@
             [self error:S3DH_RHELPER_NIL_SUMMARY data:nil error: &e ];
             return false;
         };
+
+        // Needed by the first reset, the other shared objects are only used once the download starts. The part size is read
+        // here rather than set afterwards, the reset may hash the persisted file against a multipart ETag.
+        if ( [_delegate respondsToSelector: @selector(manifest)] ) _manifest = [_delegate manifest];
+        if ( [_delegate respondsToSelector: @selector(multipartPartSize)] ) _multipartPartSize = [_delegate multipartPartSize];
         [self reset];
     }
     return self;
 }
 
+-(void)dealloc{
+    [_stallTimer invalidate];
+}
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Public Control Methods
 // ---------------------------------------------------------------------------------------------------------------------
 
 -(BOOL)cancel{
+
+    // Requests can only be cancelled from the thread that started them, so move to the engine.
+    if ( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self cancel]; }];
+        return true;
+    }
+
     BOOL result = true;
     result &= [self reset];
-    if (_state == SAVED ){
+    if (_state == SAVED || ( _state == VERIFYING && [_verifyingPath isEqualToString: _persistPath ] ) ){
         result &= [_delegate deleteFile:self];
     }
+    else{
+        // Drop any partial download that reset kept for resuming.
+        [self removeCheckpoint];
+        [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: nil];
+    }
+    [_manifest removeEntryForKey: _key ];
     _state = CANCELLED;
+    _verifyingPath = nil;
     return result;
 }
 
 
 // Reset will re-initialise the request from any state, delete all invalid files and prepare for re-start.
 -(BOOL)reset{
-    
-    NSError *error;
 
     // Reset can be invoked from any object state and will delete all data and stop the download.
-    _blockComplete          = YES;                              // Set block complete so first block download can start
-    _getObjectRequest       = nil;                              // Clear any old request objectst objects.
+    [self cancelActiveBlocks];                                  // Cancel any block requests still in flight.
     _attempts               = 0;                                // Reset the number of failed download attempts.
+    _retryAfter             = 0;                                // Cancel any backoff in progress.
+    _borrowedRanges         = 0;                                // Lent slots are recalculated by the scheduler.
     _dataTransfered         = 0;                                // Reset the transfered data records.
-    _blockRequestEnd        = 0;                                // Expected end of the last block request.
+    _committedLength        = 0;                                // Nothing has been committed to the new file.
     _state                  = INITIALISED;                      // Reset the object to the default state.
     
     _key                    = _S3Summary.key;                   // Extract the file key from the S3Summary.
-    _fileSize               = (NSInteger)_S3Summary.size;       // Extract the expected length from the S3Summary.
+    _fileSize               = [self listedSize];                // Extract the expected length from the S3Summary.
+    _blockMap               = [[S3BlockMap alloc] initWithLength: _fileSize blockSize: DOWNLOAD_MIN_BLOCK_SIZE ];
 
     _md5                   = [_S3Summary.etag stringByTrimmingCharactersInSet:
                               [NSCharacterSet characterSetWithCharactersInString:@"\""]];
+    _digest                 = [self emptyDigest];               // Restart the running hash from the first byte.
 
     _downloadPath           = [_delegate downloadPath: self];   // Obtain the save file path from the helper object.
     _persistPath            = [_delegate persistPath:  self];   // Obtain the temporary file path from the helper object
+    _checkpointPath         = [_downloadPath stringByAppendingPathExtension: @"state"];
 
     // Clean up and open streams, old files and check that the filepath is writtable.
-    if (_outputStream != nil)   [_outputStream close];          // Close any open stream.
-    
+    [self closeFile];                                           // Close any open file writer.
+    _verifyingPath          = nil;                              // Ignore the result of any verification in progress.
+    _verification ++;
 
-    if( [ _delegate validateMD5forPersist: self ] ){
-        _state = SAVED;
-        [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: &error];
-        return true;
+    switch ( [self checkPersist] ) {
+        case S3DH_PERSIST_CURRENT:      return [self resetToPersist];
+        case S3DH_PERSIST_STALE:        return [self resetToDownload];
+        case S3DH_PERSIST_UNCHECKED:    break;
     }
-    else if( [_delegate validateMD5forDownload:self] ){
-        _state = TRANSFERED;
 
-        if( ! [self createFolderForFilePath: _persistPath ] ){
-            [self error:S3DH_RHELPER_FOLDER_FAIL data:nil error: &error ];
-            return false;
+    // Files saved before the manifest, or suspect since, are hashed on the file pool and the reset finishes on the engine.
+    __weak S3RequestHelper *weakSelf = self;
+    [self verifyFileAtPath: _persistPath completion:^(BOOL valid) {
+        if( valid ){
+            [weakSelf recordSavedFileVerified: YES ];
+            [weakSelf resetToPersist];
         }
+        else{
+            [weakSelf removeSavedETag];
+            [weakSelf resetToDownload];
+        }
+    }];
+    return true;
+}
+
+// The listed version is already at the persist path, nothing needs downloading.
+-(BOOL)resetToPersist{
+    _state = SAVED;
+    [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: nil];
+    [self removeCheckpoint];
+    return true;
+}
 
-        _state      = TRANSFERED;
-        _progress   = 100;
-        [_delegate downloadFinished: self];
+// Continues a partial download from an earlier session, accepts a whole download file that still has to be persisted, or
+// starts again from the first byte.
+-(BOOL)resetToDownload{
+
+    if( [self restoreCheckpoint] && ! _blockMap.isComplete ){
+        // Partial download of the same object from an earlier session, continue from the blocks that completed.
+        _state = SUSPENDED;
         return true;
     }
-    else{
-        
-        [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: &error];
-        if( ! [self createFolderForFilePath: _downloadPath] ){
-            [self error:S3DH_RHELPER_FOLDER_FAIL data:nil error: &error ];
-            return false;
-        }
+    if( ! [[NSFileManager defaultManager] fileExistsAtPath: _downloadPath ] ) return [self resetToStart];
+
+    // Only a download file that exists can be persisted, an empty digest would otherwise match a zero byte object.
+    __weak S3RequestHelper *weakSelf = self;
+    [self verifyFileAtPath: _downloadPath completion:^(BOOL valid) {
+        if( valid ) [weakSelf finishDownload];
+        else [weakSelf resetToStart];
+    }];
+    return true;
+}
+
+-(BOOL)resetToStart{
+    NSError *error;
+
+    _state              = INITIALISED;
+    [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: &error];
+    [self removeCheckpoint];
+    _blockMap           = [[S3BlockMap alloc] initWithLength: _fileSize blockSize: DOWNLOAD_MIN_BLOCK_SIZE ];
+    _digest             = [self emptyDigest];
+    _dataTransfered     = 0;
+    _committedLength    = 0;
+    if( ! [self createFolderForFilePath: _downloadPath] ){
+        [self error:S3DH_RHELPER_FOLDER_FAIL data:nil error: &error ];
+        return false;
     }
     return true;
 }
@@ -181,21 +343,31 @@
 // Download will start or restart the download, if the bucket is reachable and downloads are enabled.
 -(BOOL)synchronise{
 
+    // Requests must be started on the engine event loop so that their callbacks are serviced.
+    if ( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self synchronise]; }];
+        return true;
+    }
+
     NSError *error;
 
     // If the delegate is disabled don't restart this object.
     if ( ! [ _delegate downloadEnable ] ) return false;
 
-    // if download has been called to restart the download, but the previous block has not completed, set a timeout.
-    if ( ! _blockComplete && _state == SUSPENDED ){
-        if( _timeOut == nil ){
-            _timeOut = [NSTimer timerWithTimeInterval:TIME_OUT_INTERVAL target:self selector:@selector(connectionTimedOut) userInfo:nil repeats:NO];
-            [[NSRunLoop currentRunLoop] addTimer:_timeOut forMode: NSDefaultRunLoopMode ];
-            return false;
-        }
+    // A negative length can only come from a corrupt listing, nothing can be requested against it.
+    if ( _fileSize < 0 && ( _state == INITIALISED || _state == SUSPENDED ) ){
+        [self error: S3DH_RHELPER_SIZE_MISMATCH data: _key error: nil ];
+        return false;
     }
-    
+
+    // Small objects skip the download file and block requests, a single GET fetches and saves them.
+    if ( [self isSmallObject] && ( _state == INITIALISED || _state == SUSPENDED ) ){
+        _state          = DOWNLOADING;
+        return [self requestObject];
+    }
+
     switch ( _state ) {
+        case VERIFYING:     return false; break;
         case FAILED:        return false; break;
         case SAVED:         return false; break;
         case TRANSFERED:    return false; break;
@@ -203,52 +375,44 @@
         case DOWNLOADING:
             break;
         case INITIALISED:
-            if( ! (_outputStream = [ [ NSOutputStream alloc ] initToFileAtPath: _downloadPath append: NO ] ) ){
-                [self error:S3DH_RHELPER_FILE_INIT_FAIL data:nil error: &error ];
+            if( ! [self openFileTruncating: YES ] ){
+                error = _error;
+                [self error:S3DH_RHELPER_FILE_INIT_FAIL data:_downloadPath error: &error ];
+                return false;
+            }
+            if( ! [self preallocateFile] ){
+                error = _error;
+                [self error:S3DH_RHELPER_FILE_UNWRITABLE data:_downloadPath error: &error ];
                 return false;
             }
-            [_outputStream open];
             break;
         case SUSPENDED:
-            if( ! ( _outputStream = [ [ NSOutputStream alloc ] initToFileAtPath: _downloadPath append: YES ] ) ){
-                [self error:S3DH_RHELPER_FILE_STREAM_FAIL data:nil error: &error ];
+            if( ! [self openFileTruncating: NO ] ){
+                error = _error;
+                [self error:S3DH_RHELPER_FILE_STREAM_FAIL data:_downloadPath error: &error ];
                 return false;
             }
-            [_outputStream open];
             break;
     }
 
-    _blockComplete      = NO;                           // Indicate that there is a block in progress.
     _state              = DOWNLOADING;                  // Show that the request has become an active download.
 
-    // Calculate the end of the next block, and limit if it is beyond the end of file.
-    _blockRequestEnd = DOWNLOAD_BLOCK_SIZE + _dataTransfered;
-    if( _blockRequestEnd > (_fileSize - 1) )    _blockRequestEnd = _fileSize - 1;
-    
-    // Initialise an S# request object to fetch the data for this block.
-    if ( !( _getObjectRequest = [[S3GetObjectRequest alloc] initWithKey: _key withBucket: _bucket] ) ){
-        [self error:S3DH_RHELPER_FILE_CREATE_FAIL data:nil error: &error ];
-        return false;
-    }
-    _getObjectRequest.outputStream  = _outputStream;
-    _getObjectRequest.delegate      = self;
-    [_getObjectRequest setRangeStart: _dataTransfered  rangeEnd: _blockRequestEnd ];
-    S3GetObjectResponse *getObjectResponse = [_client getObject: _getObjectRequest];
-    
-    // If the getObjectResponse has an error call interrupted download to handle and return false.
-    if ( getObjectResponse.error != nil ){
-        [self interruptedDownload];
-        return false;
-    }
-    return true;
+    return [self requestBlocks];
 }
 
 // Suspend a download that is in progress, used by the helper to stop downloading when connectivity is lost.
 -(BOOL)suspend{
 
+    // Requests can only be cancelled from the thread that started them, so move to the engine.
+    if ( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self suspend]; }];
+        return true;
+    }
+
     // Return false if this is called when the state is not downloading.
     switch ( _state ) {
         case INITIALISED:   return false; break;
+        case VERIFYING:     return false; break;
         case SUSPENDED:     return false; break;
         case FAILED:        return false; break;
         case TRANSFERED:    return false; break;
@@ -257,11 +421,13 @@
         case DOWNLOADING:   break;
     }
 
-    // Stop the download object, close filestream and set state suspended.
-    _getObjectRequest   = nil;
-    [_outputStream close];
+    // Stop the block requests, save the completed blocks, close the file and set state suspended.
+    [self cancelActiveBlocks];
+    if ( ! [self isSmallObject] ) [self saveCheckpoint];
+    [self closeFile];
     _state              = SUSPENDED;
     _attempts           = 0;
+    _retryAfter         = 0;
     return true;
 }
 
@@ -270,6 +436,7 @@
 
     switch ( _state ) {
         case INITIALISED:   return false; break;
+        case VERIFYING:     return false; break;
         case SUSPENDED:     return false; break;
         case FAILED:        return false; break;
         case DOWNLOADING:   return false; break;
@@ -284,6 +451,7 @@
         return false;
     }
     _state = SAVED;
+    [self recordSavedFileVerified: YES ];
     return true;
 }
 
@@ -308,58 +476,757 @@
     return true;
 }
 
-// If block doesn't complete within the timeOut period, set complete and restart the download.
-- (BOOL)connectionTimedOut{
-    _blockComplete = YES;
-    [_timeOut invalidate];
-    _timeOut = nil;
-    return [self synchronise];
+// Opens the shared file writer, a new download is emptied so that it can be reserved at the full object size.
+-(BOOL)openFileTruncating:(BOOL)truncate{
+
+    NSError *error;
+
+    [self closeFile];
+
+    if( ! ( _fileWriter = [[S3FileWriter alloc] initWithPath: _downloadPath truncate: truncate error: &error ] ) ){
+        _error = error;
+        return false;
+    }
+    return true;
+}
+
+// Reserves the full object size on disk, so blocks can be written at their own offsets in any order and the download can't
+// fail for lack of space part way through.
+-(BOOL)preallocateFile{
+    if( ! [_fileWriter preallocateLength: _fileSize ] ){
+        _error = _fileWriter.error;
+        [self closeFile];
+        return false;
+    }
+    return true;
+}
+
+-(void)closeFile{
+    [_fileWriter close];
+    _fileWriter = nil;
+}
+
+// Issues block requests until the parallel range limit is reached or every block has been requested. Prefetch requests are
+// only issued while earlier blocks are streaming, so at most parallelRanges requests are ever waiting for a response.
+-(BOOL)requestBlocks{
+
+    // Backing off after a failure, the scheduled retry requests the blocks.
+    if ( _retryAfter > [NSDate timeIntervalSinceReferenceDate] ) return true;
+
+    while ( _state == DOWNLOADING && [self hasFreeBlockSlot] ) {
+        NSUInteger units = MAX( _blockSizer.blockSize / DOWNLOAD_MIN_BLOCK_SIZE, 1 );
+
+        // Under a bandwidth cap keep each range within the burst, so no single request puts the shared bucket into debt.
+        if ( _bandwidthLimiter.rate > 0 ) units = MIN( units, MAX( (NSUInteger)( _bandwidthLimiter.burst / DOWNLOAD_MIN_BLOCK_SIZE ), 1 ) );
+
+        // With borrowed slots share out the remaining blocks, so the first request does not claim the range the others came for.
+        if ( _borrowedRanges > 0 ){
+            NSUInteger slots = MAX( _parallelRanges, 1 ) + _borrowedRanges;
+            units = MIN( units, MAX( _blockMap.unrequestedBlocks / slots, 1 ) );
+        }
+        NSRange blocks = [_blockMap requestBlocks: units ];
+        if ( blocks.location == NSNotFound ) break;
+        if ( ! [self requestBlocks: blocks ] ) return false;
+    }
+
+    // Nothing left to request or in flight, so the download is finished (zero length objects finish here).
+    if ( _state == DOWNLOADING && [_activeBlocks count] == 0 && _blockMap.isComplete ) {
+        [self completeDownload];
+    }
+    return true;
+}
+
+// Claims a range for a single block request and issues it.
+-(BOOL)requestBlocks:(NSRange)blocks{
+
+    int64_t start       = [_blockMap offsetOfBlock: blocks.location ];
+    int64_t length      = [_blockMap lengthOfBlocks: blocks ];
+    if ( length <= 0 ) return true;                             // Nothing to fetch, a zero byte range has no valid end.
+    int64_t end         = start + length - 1;
+
+    S3BlockRequest *block = [[S3BlockRequest alloc] initWithBlocks: blocks rangeStart: start rangeEnd: end ];
+    [_activeBlocks addObject: block ];
+
+    return [self issueBlock: block ];
+}
+
+// Reserves the block's bytes from the bandwidth limiter, then starts it. The requests in flight are bounded by the scheduler's
+// active helpers and their parallel ranges, the SDK gives no control over the connections beneath them.
+-(BOOL)issueBlock:(S3BlockRequest*)block{
+
+    if ( ! _bandwidthLimiter ) return [self startBlock: block ];
+
+    // The limiter calls back immediately if the bucket covers the range, otherwise once it has refilled.
+    block.reservation = [_bandwidthLimiter reserveBytes: block.length completion:^{
+        if ( [self isActiveBlock: block ] && _state == DOWNLOADING ) [self startBlock: block ];
+    }];
+    return true;
+}
+
+// Creates and starts a single ranged request writing into its own region of the download file.
+-(BOOL)startBlock:(S3BlockRequest*)block{
+
+    // The block may have been cancelled while waiting for its reservation.
+    if ( ! [self isActiveBlock: block ] || _state != DOWNLOADING ) return false;
+    block.outputStream  = [[S3BlockOutputStream alloc] initWithFileWriter: _fileWriter offset: block.rangeStart length: (NSUInteger)block.length ];
+
+    // Initialise an S3 request object to fetch the data for this block.
+    if ( !( block.request = [[S3GetObjectRequest alloc] initWithKey: _key withBucket: _bucket] ) ){
+        [self error:S3DH_RHELPER_FILE_CREATE_FAIL data:nil error: nil ];
+        return false;
+    }
+    [block.outputStream open];
+    block.request.outputStream  = block.outputStream;
+    block.request.delegate      = self;
+    block.request.ifMatch       = _S3Summary.etag;      // Guard against the object changing between ranges or sessions.
+    [block.request setRangeStart: block.rangeStart rangeEnd: block.rangeEnd ];
+
+    // Watch the blocks in flight for stalls, the timer stops itself once nothing is downloading.
+    if ( ! _stallTimer ){
+        __weak S3RequestHelper *weakSelf = self;
+        _stallTimer = [_engine scheduledTimerWithTimeInterval: S3DH_STALL_TICK repeats: YES block:^(NSTimer *timer) {
+            [weakSelf stallTimerFired: timer ];
+        }];
+    }
+
+    block.startTime = [NSDate timeIntervalSinceReferenceDate];
+    if ( ! block.primary ){
+        [_latencyTracker recordRequest];
+        [self scheduleHedgeForBlock: block ];
+    }
+    S3GetObjectResponse *getObjectResponse = [_client getObject: block.request];
+
+    // If the getObjectResponse has an error call interrupted download to handle and return false.
+    if ( getObjectResponse.error != nil ){
+        [self interruptedBlock: block ];
+        return false;
+    }
+    return true;
+}
+
+// True if another block request can be issued under the parallel range, borrowed range and prefetch limits.
+-(BOOL)hasFreeBlockSlot{
+
+    NSUInteger parallel = MAX( _parallelRanges, 1 ) + _borrowedRanges;
+    NSUInteger waiting  = 0;
+
+    for ( S3BlockRequest *block in _activeBlocks ) {
+        if ( block.firstByteTime == 0 ) waiting ++;
+    }
+    return [_activeBlocks count] < parallel + _prefetchDepth && waiting < parallel;
+}
+
+// Advances the commit point over blocks that have completed in order, later blocks wait for the gaps before them to fill.
+-(void)commitBlocks{
+    _committedLength = _blockMap.committedLength;
+
+    // Blocks that completed ahead of the hashed data are on disk, hash them from the file to keep the digest in step.
+    if( _digest.hashedOffset < _committedLength ){
+        [_digest updateFromFileDescriptor: _fileWriter.fileDescriptor toOffset: _committedLength ];
+    }
+
+    if( [NSDate timeIntervalSinceReferenceDate] - _lastCheckpoint > CHECKPOINT_INTERVAL ){
+        [self saveCheckpoint];
+    }
+}
+
+// Saves the completed block list next to the download file, the file data is synced first so that every block recorded as
+// complete is on disk if the app is killed.
+-(BOOL)saveCheckpoint{
+
+    _lastCheckpoint = [NSDate timeIntervalSinceReferenceDate];
+    if( _fileWriter && ! [_fileWriter synchronise] ) return false;
+
+    NSDictionary *checkpoint = [NSDictionary dictionaryWithObjectsAndKeys:
+                                _S3Summary.etag,                                @"etag",
+                                [NSNumber numberWithLongLong: _fileSize],                       @"size",
+                                [NSNumber numberWithUnsignedInteger: DOWNLOAD_MIN_BLOCK_SIZE], @"blockSize",
+                                [_blockMap completedBitmap],                    @"completed",
+                                _digest.state,                                  @"digest", nil ];
+    return [checkpoint writeToFile: _checkpointPath atomically: YES ];
+}
+
+// Restores the block map from a checkpoint left by an earlier download of the same object version, returns false if there is
+// no checkpoint or it describes a different ETag, size or block size.
+-(BOOL)restoreCheckpoint{
+
+    NSDictionary *checkpoint = [NSDictionary dictionaryWithContentsOfFile: _checkpointPath ];
+    if( ! checkpoint ) return false;
+
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath: _downloadPath error: nil ];
+
+    if( ! [[checkpoint objectForKey: @"etag"] isEqualToString: _S3Summary.etag ] ) return false;
+    if( [[checkpoint objectForKey: @"blockSize"] unsignedIntegerValue] != DOWNLOAD_MIN_BLOCK_SIZE ) return false;
+    if( ! [self matchesListedSize: [[checkpoint objectForKey: @"size"] longLongValue] ] ) return false;
+    if( ! attributes || (int64_t)[attributes fileSize] != _fileSize ) return false;
+
+    S3BlockMap *blockMap = [[S3BlockMap alloc] initWithLength: _fileSize blockSize: DOWNLOAD_MIN_BLOCK_SIZE
+                                              completedBitmap: [checkpoint objectForKey: @"completed"] ];
+    if( ! blockMap ) return false;
+
+    _blockMap           = blockMap;
+    S3ObjectDigest *digest = [[S3ObjectDigest alloc] initWithState: [checkpoint objectForKey: @"digest"] ];
+    if( digest && digest.hashedOffset <= _fileSize ) _digest = digest;   // Otherwise hash from the start on the next commit.
+    _dataTransfered     = _blockMap.completedLength;
+    _committedLength    = _blockMap.committedLength;
+    _progress           = ( _fileSize > 0 ) ? (int)( ( _dataTransfered * 100 ) / _fileSize ) : 0;
+    return true;
+}
+
+// The persisted file is current if it was saved from the listed ETag and has the listed size. Files saved before ETags were
+// recorded are left unchecked for reset to hash once and stamp, so later resets only read the file attributes. A file that is
+// rejected loses its stamp, so nothing trusts it again before it has been replaced. An entry taken on trust from the stamp is
+// unverified, it is hashed the next time it is checked and only a verified entry is offered to the server as an intact copy.
+-(S3DH_PERSIST_CHECK)checkPersist{
+
+    _persistedETag = nil;
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath: _persistPath error: nil ];
+    if( ! attributes ) return S3DH_PERSIST_STALE;
+
+    // A verified manifest entry that still matches the file on disk answers without reading it. A file that no longer matches
+    // its entry is suspect and is hashed, whatever its attribute says.
+    S3ManifestEntry *entry = [_manifest entryForKey: _key ];
+    BOOL listed = [entry.etag isEqualToString: _md5 ] && [self matchesListedSize: entry.size ];
+    if( entry.verified && [entry matchesFileAtPath: _persistPath ] ){
+        if( listed ) return S3DH_PERSIST_CURRENT;
+
+        // An intact copy of another version, the single GET only fetches the object if it has not gone back to that version.
+        _persistedETag = entry.etag;
+        return S3DH_PERSIST_STALE;
+    }
+
+    // An unverified entry for another version is not worth hashing against the listed ETag, drop the stamp and download.
+    if( entry && ! entry.verified && [entry matchesFileAtPath: _persistPath ] && ! listed ){
+        [self removeSavedETag];
+        return S3DH_PERSIST_STALE;
+    }
+
+    NSString *savedETag = entry ? nil : [self savedETag];
+    if( savedETag ){
+        if( [savedETag isEqualToString: _md5 ] && [self matchesListedSize: (int64_t)[attributes fileSize] ] ){
+            [self recordSavedFileVerified: NO ];
+            return S3DH_PERSIST_CURRENT;
+        }
+        [self removeSavedETag];
+        return S3DH_PERSIST_STALE;
+    }
+    return S3DH_PERSIST_UNCHECKED;
+}
+
+// Hashes a file on the engine's file pool through the delegate, the helper is VERIFYING until the completion runs on the engine.
+// A reset or cancel in the meantime starts over, and the result of the earlier verification is dropped. The file pool is apart
+// from the listing workers, so a listing that finds many unchecked files carries on while they are hashed a few at a time.
+-(void)verifyFileAtPath:(NSString*)path completion:(void (^)(BOOL valid))completion{
+    _state                  = VERIFYING;
+    _verifyingPath          = path;
+    NSUInteger verification = ++_verification;
+
+    BOOL persisted                          = [path isEqualToString: _persistPath ];
+    id <S3RequestHelperDelegateProtocol> delegate = _delegate;
+    S3TransferEngine *engine                = _engine;
+    __weak S3RequestHelper *weakSelf        = self;
+    [_engine performFileBlock:^{
+        S3RequestHelper *helper = weakSelf;
+        if( ! helper ) return;
+
+        BOOL valid = persisted ? [delegate validateMD5forPersist: helper ] : [delegate validateMD5forDownload: helper ];
+        [engine performBlock:^{ [weakSelf finishVerification: verification valid: valid completion: completion ]; }];
+    }];
+}
+
+-(void)finishVerification:(NSUInteger)verification valid:(BOOL)valid completion:(void (^)(BOOL valid))completion{
+    if( verification != _verification || _state != VERIFYING ) return;
+
+    _verifyingPath = nil;
+    completion( valid );
+
+    // The completion may have started a second verification, the delegate hears once the helper has settled.
+    if( _state != VERIFYING && [_delegate respondsToSelector: @selector(verificationFinished:)] ){
+        [_delegate verificationFinished: self ];
+    }
+}
+
+// ETag the persisted file was saved from, nil if there is no file or it was not saved by a helper.
+-(NSString*)savedETag{
+    char value[ 256 ];
+    ssize_t length = getxattr( [_persistPath fileSystemRepresentation], S3DH_ETAG_XATTR, value, sizeof( value ), 0, 0 );
+    if( length <= 0 ) return nil;
+    return [[NSString alloc] initWithBytes: value length: (NSUInteger)length encoding: NSUTF8StringEncoding ];
+}
+
+-(void)removeSavedETag{
+    removexattr( [_persistPath fileSystemRepresentation], S3DH_ETAG_XATTR, 0 );
+}
+
+// Stamps the persisted file with the ETag it was saved from and records it in the manifest, verified if its contents were
+// checked against the ETag.
+-(void)recordSavedFileVerified:(BOOL)verified{
+    const char *value = [_md5 UTF8String];
+    setxattr( [_persistPath fileSystemRepresentation], S3DH_ETAG_XATTR, value, strlen( value ), 0, 0 );
+
+    [_manifest setEntry: [[S3ManifestEntry alloc] initWithETag: _md5 lastModified: _S3Summary.lastModified filePath: _persistPath
+                                                      verified: verified ] forKey: _key ];
+}
+
+// S3ObjectSummary.size is an NSInteger, on 32 bit devices an object of 2 GB or more is listed truncated to 32 bits. Read back
+// as unsigned the listing is exact up to 4 GB, larger objects are corrected from the first response. Once a response has
+// reported the length it is used from then on.
+-(int64_t)listedSize{
+    if ( _reportedSize >= 0 ) return _reportedSize;
+    if ( sizeof( NSInteger ) < sizeof( int64_t ) ) return (int64_t)(NSUInteger)_S3Summary.size;
+    return (int64_t)_S3Summary.size;
+}
+
+// A size recorded with a file of the same ETag matches if it is the listed size, or on 32 bit devices if the listing truncated
+// it. A match of a truncated listing is adopted as the object's length, as a response would be.
+-(BOOL)matchesListedSize:(int64_t)size{
+    if ( size == _fileSize ) return true;
+    if ( sizeof( NSInteger ) >= sizeof( int64_t ) || _reportedSize >= 0 ) return false;
+    if ( size < 0 || (uint32_t)size != (uint32_t)_fileSize ) return false;
+
+    _reportedSize   = size;
+    _fileSize       = size;
+    return true;
+}
+
+// Compares the object length a response reported with the listed size. A length that only differs above the low 32 bits is
+// the real length of an object the listing truncated, the download starts again with it. Any other difference fails.
+-(BOOL)checkReportedLength:(int64_t)length{
+    if ( length < 0 || length == _fileSize ) return true;
+
+    if ( _fileSize < 0 || (uint32_t)length != (uint32_t)_fileSize ){
+        NSString *data = [[NSString alloc] initWithFormat:@"[%@] [Listed:%lld] [Reported:%lld]", _key, _fileSize, length ];
+        [self error: S3DH_RHELPER_SIZE_MISMATCH data: data error: nil ];
+        return false;
+    }
+
+    [self cancelActiveBlocks];
+    [self closeFile];
+    _reportedSize   = length;
+    _fileSize       = length;
+    if ( [self resetToStart] ) [self synchronise];
+    return false;
+}
+
+// Total length of the object from the Content-Range of a ranged response, or the Content-Length of a whole one, -1 if the
+// response does not say.
+-(int64_t)reportedLengthOfResponse:(NSURLResponse*)response{
+    if ( ! [response isKindOfClass: [NSHTTPURLResponse class]] ) return -1;
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse*)response;
+    if ( httpResponse.statusCode != 200 && httpResponse.statusCode != 206 ) return -1;
+
+    NSString *contentRange = [[httpResponse allHeaderFields] objectForKey: @"Content-Range"];
+    if ( ! contentRange ) return ( httpResponse.statusCode == 200 ) ? httpResponse.expectedContentLength : -1;
+
+    NSRange slash = [contentRange rangeOfString: @"/" options: NSBackwardsSearch ];
+    if ( slash.location == NSNotFound ) return -1;
+    NSString *total = [contentRange substringFromIndex: NSMaxRange( slash ) ];
+    return [total isEqualToString: @"*"] ? -1 : [total longLongValue];
+}
+
+// Digest with nothing hashed, set up for a multipart ETag if the object was uploaded in parts.
+-(S3ObjectDigest*)emptyDigest{
+    return [[S3ObjectDigest alloc] initWithETag: _md5 length: _fileSize partSize: _multipartPartSize ];
+}
+
+-(void)removeCheckpoint{
+    [[NSFileManager defaultManager] removeItemAtPath: _checkpointPath error: nil];
+}
+
+// Returns the in flight block record for an SDK request, nil if the request has been cancelled.
+-(S3BlockRequest*)blockForRequest:(AmazonServiceRequest*)request{
+    for ( S3BlockRequest *block in _activeBlocks ) {
+        if ( block.request == request ) return block;
+        if ( block.hedge.request == request ) return block.hedge;
+    }
+    return nil;
+}
+
+// A block is active if it is in the active list, or is the current hedge of a block that is.
+-(BOOL)isActiveBlock:(S3BlockRequest*)block{
+    if ( block.primary ) return block.primary.hedge == block && [_activeBlocks containsObject: block.primary ];
+    return [_activeBlocks containsObject: block ];
+}
+
+// Arms the hedge for a block once enough durations are known, a block still running at the percentile duration of blocks its
+// size is raced.
+-(void)scheduleHedgeForBlock:(S3BlockRequest*)block{
+    NSTimeInterval threshold = [_latencyTracker percentile: DEFAULT_HEDGE_PERCENTILE forLength: block.length ];
+    if ( threshold <= 0 ) return;
+
+    __weak S3RequestHelper *weakSelf   = self;
+    __weak S3BlockRequest  *weakBlock  = block;
+    [_engine performBlock:^{ [weakSelf hedgeBlock: weakBlock]; } afterDelay: threshold ];
+}
+
+// Issues a duplicate request for a slow block's range. Both requests write the same bytes to the same offsets, so whichever
+// completes first leaves the range whole. The hedge is started at once rather than queued behind the bandwidth limiter, a hedge
+// that waited would be no faster than the block it races. The primary has reserved the range's bytes,
+// and the bucket wide allowance keeps the extra requests to a small fraction.
+-(void)hedgeBlock:(S3BlockRequest*)block{
+    if ( _state != DOWNLOADING || ! block || block.hedge || ! [_activeBlocks containsObject: block ] ) return;
+    if ( ! [_latencyTracker acquireHedge] ) return;
+
+    S3BlockRequest *hedge = [[S3BlockRequest alloc] initWithBlocks: block.blocks rangeStart: block.rangeStart rangeEnd: block.rangeEnd ];
+    hedge.primary   = block;
+    block.hedge     = hedge;
+
+    [self startBlock: hedge ];
+}
+
+// Keeps the winner of a block and its hedge and cancels the other, a winning hedge takes the primary's place in the active list.
+-(void)settleHedgeForWinner:(S3BlockRequest*)winner{
+    S3BlockRequest *loser = winner.primary ? winner.primary : winner.hedge;
+    if ( ! loser ) return;
+
+    // A winning hedge also carries on with the primary's reservation, it has fetched the range in its place.
+    if ( winner.primary ){
+        [_activeBlocks replaceObjectAtIndex: [_activeBlocks indexOfObject: loser ] withObject: winner ];
+        _dataTransfered = _dataTransfered - loser.received + winner.received;
+        winner.reservation  = loser.reservation;
+        loser.reservation   = nil;
+    }
+    winner.primary  = nil;
+    winner.hedge    = nil;
+    loser.primary   = nil;
+    loser.hedge     = nil;
+
+    [loser cancel];
+    [self releaseReservationForBlock: loser ];
+}
+
+// Cancels every block in flight and returns their ranges to the block map.
+-(void)cancelActiveBlocks{
+
+    [self cancelObjectRequest];
+
+    // Empty the list first, refunding a reservation can start a block that was waiting on the bandwidth limiter.
+    NSArray *blocks = [_activeBlocks copy];
+    [_activeBlocks removeAllObjects];
+
+    for ( S3BlockRequest *block in blocks ) {
+        if ( block.hedge ){
+            [block.hedge cancel];
+            [self releaseReservationForBlock: block.hedge ];
+            block.hedge = nil;
+        }
+        [block cancel];
+        [self releaseReservationForBlock: block ];
+        [_blockMap releaseBlocks: block.blocks ];
+        _dataTransfered -= block.received;
+    }
+}
+
+// Removes a finished or failed block from the active list.
+-(void)retireBlock:(S3BlockRequest*)block{
+    [block finish];
+    [_activeBlocks removeObject: block ];
+    [self releaseReservationForBlock: block ];
+}
+
+// Returns the reserved bytes the block did not receive to the bandwidth limiter, a reservation still waiting is dropped.
+-(void)releaseReservationForBlock:(S3BlockRequest*)block{
+    if ( block.reservation ) [_bandwidthLimiter cancelReservation: block.reservation usedBytes: block.received ];
+    block.reservation = nil;
+}
+
+// Checks every block and hedge in flight, a stalled request is cancelled and its range requested again.
+-(void)stallTimerFired:(NSTimer*)timer{
+
+    if ( _state != DOWNLOADING || [_activeBlocks count] == 0 ){
+        [_stallTimer invalidate];
+        _stallTimer = nil;
+        return;
+    }
+
+    NSTimeInterval now  = [NSDate timeIntervalSinceReferenceDate];
+    NSMutableArray *stalled = [[NSMutableArray alloc] init];
+    for ( S3BlockRequest *block in _activeBlocks ){
+        if ( [_stallDetector checkBlock: block atTime: now ] != S3DH_STALL_NONE ) [stalled addObject: block ];
+        if ( block.hedge && [_stallDetector checkBlock: block.hedge atTime: now ] != S3DH_STALL_NONE ) [stalled addObject: block.hedge ];
+    }
+
+    // Interrupting one block can promote or drop another, so only act on blocks that are still active.
+    for ( S3BlockRequest *block in stalled ){
+        if ( _state == DOWNLOADING && [self isActiveBlock: block ] ) [self interruptedBlock: block ];
+    }
+}
+
+// Called once every block has been written, checks the md5 on the file pool and sets the state to TRANSFERED.
+-(void)completeDownload{
+
+    [self closeFile];
+    [self removeCheckpoint];
+
+    __weak S3RequestHelper *weakSelf = self;
+    [self verifyFileAtPath: _downloadPath completion:^(BOOL valid) {
+        if( valid ) [weakSelf finishDownload];
+
+        // Download completed but with an invalid md5.
+        else [weakSelf error: S3DH_RHELPER_DOWNLOAD_ERROR data: weakSelf.key error: nil ];
+    }];
+}
+
+// The download file matched the listed md5 and is ready to persist.
+-(void)finishDownload{
+    NSError *error;
+
+    if( ! [self createFolderForFilePath: _persistPath ] ){
+        [self error:S3DH_RHELPER_FOLDER_FAIL data:nil error: &error ];
+        return;
+    }
+    _state      = TRANSFERED;
+    _progress   = 100;
+    [_delegate downloadFinished: self];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Small Object Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// True if the object is fetched whole rather than in blocks.
+-(BOOL)isSmallObject{
+    return _fileSize < _smallObjectThreshold;
+}
+
+// Issues a single un-ranged GET for the whole object, after reserving its bytes. A zero byte
+// object has nothing to fetch and is saved at once.
+-(BOOL)requestObject{
+
+    _objectData     = [[NSMutableData alloc] initWithCapacity: (NSUInteger)_fileSize ];
+    _dataTransfered = 0;
+    if ( _fileSize == 0 ) return [self saveObject];
+
+    if ( ! _bandwidthLimiter ) return [self startObject];
+
+    NSMutableData *objectData = _objectData;
+    _objectReservation = [_bandwidthLimiter reserveBytes: _fileSize completion:^{
+        if ( _objectData == objectData && _state == DOWNLOADING ) [self startObject];
+    }];
+    return true;
+}
+
+-(BOOL)startObject{
+
+    if ( !( _objectRequest = [[S3GetObjectRequest alloc] initWithKey: _key withBucket: _bucket] ) ){
+        [self error:S3DH_RHELPER_FILE_CREATE_FAIL data:nil error: nil ];
+        return false;
+    }
+    _objectRequest.delegate     = self;
+    _objectRequest.ifMatch      = _S3Summary.etag;
+
+    // If the object has gone back to the intact version on disk the server answers 304 and the file is kept without a body.
+    if ( _persistedETag ) _objectRequest.ifNoneMatch = [NSString stringWithFormat: @"\"%@\"", _persistedETag ];
+
+    S3GetObjectResponse *getObjectResponse = [_client getObject: _objectRequest ];
+    if ( getObjectResponse.error != nil ){
+        [self interruptedObject];
+        return false;
+    }
+    return true;
+}
+
+// Checks the received body against the listed md5 and writes it atomically to the persist path, there is no download file.
+-(BOOL)saveObject{
+
+    NSError *error      = nil;
+    S3ObjectDigest *digest = [self emptyDigest];
+    [digest updateWithBytes: [_objectData bytes] length: [_objectData length] atOffset: 0 ];
+
+    // A multipart ETag that no part size fits is accepted on length, the request was made with If-Match on it.
+    BOOL matches = ! digest.isVerifiable || [[digest digestForETag: _md5 ] isEqualToString: _md5 ];
+    if ( (int64_t)[_objectData length] != _fileSize || ! matches ){
+        _objectData = nil;
+        [self error: S3DH_RHELPER_DOWNLOAD_ERROR data: _key error: nil ];
+        return false;
+    }
+    if( ! [self createFolderForFilePath: _persistPath ] ){
+        [self error:S3DH_RHELPER_FOLDER_FAIL data:nil error: &error ];
+        return false;
+    }
+    if( ! [_objectData writeToFile: _persistPath options: NSDataWritingAtomic error: &error ] ){
+        [self error: S3DH_RHELPER_FILE_PERSIST_FAIL data: _persistPath error: &error ];
+        return false;
+    }
+    [self recordSavedFileVerified: YES ];
+
+    // Drop anything an earlier block download of this key left behind.
+    [self removeCheckpoint];
+    [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: nil];
+
+    _objectData     = nil;
+    _dataTransfered = _fileSize;
+    _state          = SAVED;
+    _progress       = 100;
+    [_delegate downloadFinished: self];
+    return true;
+}
+
+// The persisted file already holds the object, the body was not sent. Its manifest entry and stamp already describe it. A 304
+// to a request that did not offer the file is an error, there is nothing to keep.
+-(void)keepPersistedObject{
+    [self cancelObjectRequest];
+    if ( ! _persistedETag ){
+        [self error: S3DH_RHELPER_DOWNLOAD_ERROR data: _key error: nil ];
+        return;
+    }
+    _attempts       = 0;
+    _dataTransfered = _fileSize;
+    _state          = SAVED;
+    _progress       = 100;
+    [_delegate downloadFinished: self];
+}
+
+-(void)cancelObjectRequest{
+    _objectRequest.delegate = nil;
+    [_objectRequest cancel];
+    _objectRequest  = nil;
+    [self releaseObjectReservation];
+    _objectData     = nil;
+}
+
+// Returns the reserved bytes the small object did not receive.
+-(void)releaseObjectReservation{
+    if ( _objectReservation ) [_bandwidthLimiter cancelReservation: _objectReservation usedBytes: [_objectData length] ];
+    _objectReservation = nil;
+}
+
+// A failed small object request is retried whole after the same backoff as a failed block.
+-(void)interruptedObject{
+
+    [self cancelObjectRequest];
+    _dataTransfered = 0;
+
+    if ( ! [_delegate downloadEnable] ){
+        [self suspend];
+    }
+    else if ( _attempts < DEFAULT_RETRY_LIMIT ){
+        _attempts ++;
+        __weak S3RequestHelper *weakSelf = self;
+        [_engine performBlock:^{ [weakSelf retryObject]; } afterDelay: [_retryPolicy delayForRetry: _attempts ] ];
+    }
+    else{
+        [self error: S3DH_RHELPER_RETRY_EXCEEDED data: _key error: nil ];
+    }
+}
+
+-(void)retryObject{
+    if ( _state == DOWNLOADING && ! _objectData ) [self requestObject];
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 // PROTOCOL Methods - Amazon Service Request Delegate
 // ---------------------------------------------------------------------------------------------------------------------
-// Counts received bytes of data, when the is stream open, loaded into the file to determine next block start.
+// Records the time to first byte of a block, used by the block sizer to separate latency from throughput. Every response is
+// checked against the listed size first, the listing can be truncated on 32 bit devices.
+-(void)request:(AmazonServiceRequest *)request didReceiveResponse:(NSURLResponse *)response{
+    if( request == _objectRequest ){
+        [self checkReportedLength: [self reportedLengthOfResponse: response ] ];
+        return;
+    }
+
+    S3BlockRequest *block = [self blockForRequest: request];
+    if( block && ! [self checkReportedLength: [self reportedLengthOfResponse: response ] ] ) return;
+    if( block && block.firstByteTime == 0 ){
+        block.firstByteTime = [NSDate timeIntervalSinceReferenceDate];
+
+        // The block is streaming, so prefetch the next range while it completes.
+        [self requestBlocks];
+    }
+}
+
+// Counts received bytes of data, the block stream writes the data into the file at the block offset.
 -(void)request:(AmazonServiceRequest *)request didReceiveData:(NSData *)data{
 
-    int progress;
-    
-    if( _state == DOWNLOADING && [ request isKindOfClass:[ S3GetObjectRequest class ] ] ){
+    // Small objects are collected in memory, a body longer than the listing can never match it.
+    if( request == _objectRequest ){
+        [_objectData appendData: data ];
         _dataTransfered += [data length];
+        [self updateProgress];
+        if( _dataTransfered > _fileSize ){
+            [self cancelObjectRequest];
+            [self error: S3DH_RHELPER_FILE_DL_OVERRUN data: _key error: nil ];
+        }
+        return;
+    }
 
-        if( _fileSize == 0.0 || _dataTransfered == 0.0)    progress = 0;
-        else   progress = (_dataTransfered * 100)/ _fileSize;
-        
-        Boolean didChange = ( progress != _progress );
-        _progress = progress;
+    S3BlockRequest *block = [self blockForRequest: request];
 
-        if ( didChange && [_delegate respondsToSelector:@selector(progressChanged:)]){
-            [_delegate progressChanged: self];
-        }
+    if( _state == DOWNLOADING && block ){
+        if( block.firstDataTime == 0 ) block.firstDataTime = [NSDate timeIntervalSinceReferenceDate];
+
+        // Hash the bytes while they are in memory if they continue the digest, other blocks catch up at commit.
+        [_digest updateWithBytes: [data bytes] length: [data length] atOffset: block.rangeStart + block.received ];
+
+        // Hedge bytes duplicate the primary's, they are only counted if the hedge wins.
+        block.received  += [data length];
+        if( block.primary ) return;
+        _dataTransfered += [data length];
+
+        // The bucket's progress reporter reads the byte count on its own tick, the delegate only hears of whole percents.
+        [self updateProgress];
     }
 }
 
-// Method handles end-of-block & either restarts or checks the md5 and sets the state to TRANSFERED.
+// Recalculates the percentage downloaded and tells a delegate that asks for it when it changes.
+-(void)updateProgress{
+    int progress = ( _fileSize > 0 ) ? (int)( ( MIN( _dataTransfered, _fileSize ) * 100 ) / _fileSize ) : 0;
+    if( progress == _progress ) return;
+
+    _progress = progress;
+    if( [_delegate respondsToSelector: @selector(progressChanged:)] ) [_delegate progressChanged: self];
+}
+
+// Method handles end-of-block & either requests more blocks or completes the download.
 -(void)request:(AmazonServiceRequest *)request didCompleteWithResponse:(AmazonServiceResponse *)aResponse{
-    
-    Boolean validRequest = [ request isKindOfClass:[ S3GetObjectRequest class ] ];
-    Boolean validMD5     = [ _delegate validateMD5forDownload: self ];
-    Boolean noException  = ( aResponse.exception == nil );
-    
-    // If the block completes before the timeout time fires, cancel the timeOutTimer.
-    if(_timeOut != nil){
-        [_timeOut invalidate];
-        _timeOut = nil;
+
+    if( request == _objectRequest ){
+        if( aResponse.httpStatusCode == 304 ){
+            [self keepPersistedObject];
+            return;
+        }
+        if( aResponse.exception ){
+            _exception = aResponse.exception;
+            [self interruptedObject];
+            return;
+        }
+        _objectRequest.delegate = nil;
+        _objectRequest          = nil;
+        [self releaseObjectReservation];
+        _attempts               = 0;
+        [self saveObject];
+        return;
     }
 
-    // Set block complete flag to allow download to start the next block.
-    _blockComplete       = YES;
-    
-    // If the file lenght exceeds the AWS filesize, report error and fail download.
-    if( _blockRequestEnd > (_fileSize - 1) ){
-        [self error: S3DH_RHELPER_FILE_PERSIST_FAIL data: _key error: nil ];
+    S3BlockRequest *block = [self blockForRequest: request];
+
+    // Ignore responses for blocks that have been cancelled.
+    if( block == nil ) return;
+
+    Boolean noException  = ( aResponse.exception == nil );
+    Boolean fullBlock    = ( (int64_t)block.outputStream.bytesWritten == block.length );
+    Boolean written      = [ block.outputStream flush ];
+
+    // If the block is short, failed to write or reported an exception, request the range again.
+    if( ! ( noException && fullBlock && written ) ){
+        _exception = aResponse.exception;
+        [self interruptedBlock: block ];
+        return;
     }
-    
+
+    // The first of a block and its hedge to complete wins.
+    [self settleHedgeForWinner: block ];
+    [self retireBlock: block ];
+    [_blockMap completeBlocks: block.blocks ];
+    _attempts = 0;                                              // The link is working again, restart the backoff.
+    [self commitBlocks];
+
+    // Feed the block timing to the sizer so the next request is sized for the measured link.
+    NSTimeInterval duration     = [NSDate timeIntervalSinceReferenceDate] - block.startTime;
+    NSTimeInterval firstByte    = ( block.firstByteTime > 0 ) ? block.firstByteTime - block.startTime : 0;
+    [_blockSizer recordBlockOfLength: (NSUInteger)block.length duration: duration firstByte: firstByte ];
+    [_latencyTracker recordDuration: duration forLength: block.length ];
+
     // If the helper is disabled, or bucket unreachable, suspend download.
     if( ![ _delegate downloadEnable ] ) {
         [self suspend];
@@ -367,25 +1234,13 @@
     }else{
         // Determine the download action for each request state.
         switch ( _state ) {
-            case SUSPENDED:
             case DOWNLOADING:
-                // If the Handler is downloading, restart the next block.
-                if( _blockRequestEnd < (_fileSize - 1) ){
-                    [self synchronise];
-                }
-                else if( noException && validRequest && validMD5 ){
-                    _state              = TRANSFERED;
-                    _getObjectRequest   = nil;
-                    _progress   = 100;
-                    [_outputStream close];
-                    [_delegate downloadFinished: self];
-                }
-                else{
-                    // Download completed but with an error, exception or invalid md5.
-                    [self error: S3DH_RHELPER_DOWNLOAD_ERROR data: _key error: nil ];
-                }
+                // If the Handler is downloading, fill the free slots or complete the download.
+                [self requestBlocks];
                 break;
+            case SUSPENDED:          break;
             case INITIALISED:        break;
+            case VERIFYING:          break;
             case TRANSFERED:         break;
             case SAVED:              break;
             case FAILED:             break;
@@ -396,16 +1251,40 @@
 }
 
 -(void)request:(AmazonServiceRequest *)request didFailWithError:(NSError *)theError{
-    if( [ request isKindOfClass:[ S3GetObjectRequest class ] ] ){
+    if( request == _objectRequest ){
         _error = theError;
-        [self interruptedDownload];
+        [self interruptedObject];
+        return;
+    }
+    S3BlockRequest *block = [self blockForRequest: request];
+    if( block ){
+        _error = theError;
+        [self interruptedBlock: block];
     }
 }
 
 -(void)request:(AmazonServiceRequest *)request didFailWithServiceException:(NSException *)theException{
-    if( [ request isKindOfClass:[ S3GetObjectRequest class ] ] ){
+    S3BlockRequest *block = [self blockForRequest: request];
+    if( block || request == _objectRequest ){
         _exception = theException;
-        [self interruptedDownload];
+
+        if( request == _objectRequest && [theException isKindOfClass: [AmazonServiceException class]] &&
+            ((AmazonServiceException*)theException).statusCode == 304 ){
+            _exception = nil;
+            [self keepPersistedObject];
+            return;
+        }
+
+        // If-Match failed, the object was replaced since it was listed, so the partial download can never be completed.
+        if( [theException isKindOfClass: [AmazonServiceException class]] && ((AmazonServiceException*)theException).statusCode == 412 ){
+            [self cancelObjectRequest];
+            [self removeCheckpoint];
+            [[NSFileManager defaultManager] removeItemAtPath: _downloadPath error: nil];
+            [self error: S3DH_RHELPER_OBJECT_CHANGED data: _key error: nil ];
+            return;
+        }
+        if( block ) [self interruptedBlock: block];
+        else [self interruptedObject];
     }
 }
 
@@ -413,15 +1292,51 @@
 // PROTOCOL - Support Methods
 // ---------------------------------------------------------------------------------------------------------------------
 
-// If the download is interrupted, this method determines if it should be suspended, reported or re-started.
--(void)interruptedDownload{
+// Ends a backoff and requests the blocks released by failures, later retries that are still backing off wait for their own.
+-(void)retryBlocks{
+    NSTimeInterval remaining = _retryAfter - [NSDate timeIntervalSinceReferenceDate];
+    if ( remaining > 0 ){
+        __weak S3RequestHelper *weakSelf = self;
+        [_engine performBlock:^{ [weakSelf retryBlocks]; } afterDelay: remaining ];
+        return;
+    }
+    _retryAfter = 0;
+    if ( _state == DOWNLOADING ) [self requestBlocks];
+}
+
+-(void)interruptedBlock:(S3BlockRequest*)block{
+
+    // A failed hedge is dropped and the primary carries on, a failed primary is replaced by its hedge.
+    if ( block.primary ){
+        block.primary.hedge = nil;
+        block.primary       = nil;
+        [block cancel];
+        [self releaseReservationForBlock: block ];
+        return;
+    }
+    if ( block.hedge ){
+        [self settleHedgeForWinner: block.hedge ];
+        return;
+    }
+
+    // Return the blocks range so that it is requested again, discounting any data it had received.
+    [block cancel];
+    [_activeBlocks removeObject: block ];
+    [self releaseReservationForBlock: block ];
+    [_blockMap releaseBlocks: block.blocks ];
+    _dataTransfered -= block.received;
+    [_blockSizer recordFailedBlock];
+
     // if the connection is working check how many attempts
     if ( [_delegate downloadEnable] ){
-        // If retrys is below threshold try again.
+        // If retrys is below threshold try again after a jittered backoff, waiting longer while the bucket budget refills.
         if ( _attempts < DEFAULT_RETRY_LIMIT ){
-            // Re-start the dwonload and count the attempt.
-            [self synchronise];
             _attempts ++;
+            NSTimeInterval delay = [_retryPolicy delayForRetry: _attempts ];
+            _retryAfter = MAX( _retryAfter, [NSDate timeIntervalSinceReferenceDate] + delay );
+
+            __weak S3RequestHelper *weakSelf = self;
+            [_engine performBlock:^{ [weakSelf retryBlocks]; } afterDelay: delay ];
         }
         // If retrys is above threshold report failure.
         else{
@@ -455,27 +1370,30 @@
         case S3DH_RHELPER_FILE_DL_OVERRUN:   [ errorDesc appendString: @"Download over-ran:" ];        break;
         case S3DH_RHELPER_DOWNLOAD_ERROR:    [ errorDesc appendString: @"Download with error:" ];      break;
         case S3DH_RHELPER_RETRY_EXCEEDED:    [ errorDesc appendString: @"Exceeded Retry Limit:" ];     break;
+        case S3DH_RHELPER_OBJECT_CHANGED:    [ errorDesc appendString: @"Object changed on S3:" ];     break;
+        case S3DH_RHELPER_SIZE_MISMATCH:     [ errorDesc appendString: @"Object size mismatch:" ];     break;
         default:                              [ errorDesc appendString: @"No reported errors! "  ];     break;
     }
     
     NSMutableDictionary *userInfo = [[ NSMutableDictionary alloc ] init ];
     
     if ( data ) [ errorDesc appendFormat:@"{%@}. ", data ];
-    if( errorp ) {
+    if( errorp && *errorp ) {
         if ( [ *errorp userInfo ] )[ userInfo setDictionary: [ *errorp userInfo ] ];
         if ( [ *errorp localizedDescription ] ) [ errorDesc appendString: [ *errorp localizedDescription ] ];
     }
     
     [userInfo setObject: errorDesc forKey: NSLocalizedDescriptionKey ];
     
-    *errorp = [ NSError  errorWithDomain: S3DH_REQUEST_HELPER_DOMAIN code:code userInfo:userInfo ];
+    NSError *error = [ NSError  errorWithDomain: S3DH_REQUEST_HELPER_DOMAIN code:code userInfo:userInfo ];
+    if( errorp ) *errorp = error;
     
     // Clean up the object and downloads.
-    _error              = *errorp;
+    _error              = error;
     _state              = FAILED;
-    _getObjectRequest   = nil;
     _progress           = 0.0;
-    [_outputStream close];
+    [self cancelActiveBlocks];
+    [self closeFile];
     [_delegate downloadFailed: self ];
 }
 // ---------------------------------------------------------------------------------------------------------------------
@@ -9,6 +9,7 @@
 #import <Foundation/Foundation.h>
 
 @class S3RequestHelper;
+@class S3SyncManifest;
 
 
 typedef enum{
@@ -45,11 +46,13 @@ typedef enum{
  */
 - (NSString*)persistPath:(S3RequestHelper*)s3rh;
 
-/** Methods used to validate that the file in the download location is valid against the checksum.
+/** Methods used to validate that the file in the download location is valid against the checksum. Called on
+    one of the engine's file worker threads, as the file may have to be read in full.
  */
 - (BOOL)validateMD5forDownload:(S3RequestHelper*)s3rh;
 
-/** Methods used to validate that the file in the persist location is valid against the checksum.
+/** Methods used to validate that the file in the persist location is valid against the checksum. Called on
+    one of the engine's file worker threads, as the file may have to be read in full.
  */
 - (BOOL)validateMD5forPersist:(S3RequestHelper*)s3rh;
 
@@ -73,7 +76,23 @@ typedef enum{
 
 @optional
 
-/** Method called when the progress property of the S3RequestHelper increases by 1%.
+/** Manifest of the files saved by the initiating helper, read once when the S3RequestHelper is created
+    so that its first reset can check the persisted file against the manifest rather than hash it.
+ */
+- (S3SyncManifest*)manifest;
+
+/** Part size the objects were uploaded with, read once when the S3RequestHelper is created so that its
+    first reset validates multipart ETags with it. Return 0 to infer the part size per object.
+ */
+- (int64_t)multipartPartSize;
+
+/** Notifies the initiating helper that a VERIFYING S3RequestHelper has finished checking the files left by an
+    earlier session, and is now SAVED, TRANSFERED, SUSPENDED or INITIALISED and ready to be queued.
+ */
+- (void)verificationFinished:(S3RequestHelper*)s3rh;
+
+/** Method called when the progress property of the S3RequestHelper increases by 1%. Delegates that report
+    progress for a whole bucket should read it on a timer instead, as S3SyncHelper does.
  */
 - (void)progressChanged:(S3RequestHelper*)s3rh;
 
@@ -0,0 +1,45 @@
+//
+//  S3RetryPolicy.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 20/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#define S3DH_RETRY_BASE_DELAY   0.5         // Seconds the first retry backs off by at most.
+#define S3DH_RETRY_MAX_DELAY    30.0        // Longest backoff in seconds, however many attempts have failed.
+#define S3DH_RETRY_BUDGET       20          // Retries that can be spent at once before the budget runs dry.
+#define S3DH_RETRY_REFILL_RATE  0.5         // Retries returned to the budget per second.
+
+/** Spaces out retries of failed requests. Each retry waits a random time between zero and an exponential
+    ceiling of baseDelay * 2^(attempt-1), capped at maxDelay, so helpers that failed together retry apart.
+    Retries are also drawn from a budget shared by every helper of an S3SyncHelper that refills at
+    refillRate per second. Once it runs dry retries queue for it instead of failing, so a run of failures
+    across the bucket slows to the refill rate rather than amplifying an outage, and still recovers when
+    the outage ends. Policies are not thread safe and must only be used from the engine thread.
+ */
+@interface S3RetryPolicy : NSObject
+
+- (id)initWithBaseDelay:(NSTimeInterval)baseDelay maxDelay:(NSTimeInterval)maxDelay budget:(NSUInteger)budget refillRate:(double)refillRate;
+
+/** Random backoff for the given attempt, counting from 1, using full jitter.
+ */
+- (NSTimeInterval)delayForAttempt:(NSUInteger)attempt;
+
+/** Takes one retry from the budget and returns how long to wait before making it, the backoff for the
+    attempt plus, if the budget is empty, the time it takes to refill for this and every retry already
+    waiting on it.
+ */
+- (NSTimeInterval)delayForRetry:(NSUInteger)attempt;
+
+@property (nonatomic, assign)   NSTimeInterval  baseDelay;          // Backoff ceiling of the first attempt.
+@property (nonatomic, assign)   NSTimeInterval  maxDelay;           // Largest backoff ceiling.
+@property (nonatomic, assign)   NSUInteger      budget;             // Most retries the budget can hold.
+@property (nonatomic, assign)   double          refillRate;         // Retries returned to the budget per second.
+@property (nonatomic, readonly) double          availableRetries;   // Retries left in the budget now, negative while retries wait.
+@property (nonatomic, readonly) NSUInteger      retries;            // Retries granted.
+@property (nonatomic, readonly) NSUInteger      waits;              // Retries that waited for the budget to refill.
+
+@end
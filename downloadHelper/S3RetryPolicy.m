@@ -0,0 +1,113 @@
+//
+//  S3RetryPolicy.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 20/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3RetryPolicy.h"
+#import <stdlib.h>
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3RetryPolicy ()
+{
+    NSTimeInterval          _baseDelay;                 // Backoff ceiling of the first attempt.
+    NSTimeInterval          _maxDelay;                  // Largest backoff ceiling.
+    NSUInteger              _budget;                    // Most retries the budget can hold.
+    double                  _refillRate;                // Retries returned to the budget per second.
+
+    double                  _tokens;                    // Retries in the budget at the last refill, negative while retries wait.
+    NSTimeInterval          _lastRefill;                // Reference time the budget was last refilled.
+    NSUInteger              _retries;                   // Retries granted.
+    NSUInteger              _waits;                     // Retries that waited for the budget to refill.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3RetryPolicy
+
+@synthesize baseDelay       = _baseDelay;
+@synthesize maxDelay        = _maxDelay;
+@synthesize budget          = _budget;
+@synthesize refillRate      = _refillRate;
+@synthesize retries         = _retries;
+@synthesize waits           = _waits;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)init
+{
+    return [self initWithBaseDelay: S3DH_RETRY_BASE_DELAY maxDelay: S3DH_RETRY_MAX_DELAY
+                            budget: S3DH_RETRY_BUDGET refillRate: S3DH_RETRY_REFILL_RATE ];
+}
+
+- (id)initWithBaseDelay:(NSTimeInterval)baseDelay maxDelay:(NSTimeInterval)maxDelay budget:(NSUInteger)budget refillRate:(double)refillRate
+{
+    self = [super init];
+    if( self ){
+        _baseDelay  = baseDelay;
+        _maxDelay   = MAX( baseDelay, maxDelay );
+        _budget     = budget;
+        _refillRate = refillRate;
+        _tokens     = budget;
+        _lastRefill = [NSDate timeIntervalSinceReferenceDate];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Synthesized Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (double)availableRetries
+{
+    [self refill];
+    return _tokens;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSTimeInterval)delayForAttempt:(NSUInteger)attempt
+{
+    // Grow the ceiling exponentially, stopping once it reaches the cap so large attempt counts can not overflow.
+    NSTimeInterval ceiling = _baseDelay;
+    for( NSUInteger i = 1; i < attempt && ceiling < _maxDelay; i++ ) ceiling *= 2;
+    ceiling = MIN( ceiling, _maxDelay );
+
+    return ceiling * ( (double)arc4random() / UINT32_MAX );
+}
+
+- (NSTimeInterval)delayForRetry:(NSUInteger)attempt
+{
+    // Retries taken from an empty budget leave it in debt, each waits until the refill has paid back its share.
+    [self refill];
+    _tokens -= 1.0;
+    _retries++;
+
+    NSTimeInterval wait = 0;
+    if( _tokens < 0 ){
+        _waits++;
+        wait = _refillRate > 0 ? -_tokens / _refillRate : _maxDelay;
+    }
+    return wait + [self delayForAttempt: attempt];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Returns retries to the budget for the time elapsed since the last refill.
+- (void)refill
+{
+    NSTimeInterval now  = [NSDate timeIntervalSinceReferenceDate];
+    _tokens             = MIN( (double)_budget, _tokens + ( now - _lastRefill ) * _refillRate );
+    _lastRefill         = now;
+}
+
+@end
@@ -0,0 +1,46 @@
+//
+//  S3StallDetector.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 22/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3BlockRequest;
+
+#define S3DH_STALL_CONNECT_TIMEOUT      10.0    // Seconds from issuing a request to its response headers.
+#define S3DH_STALL_FIRST_BYTE_TIMEOUT   10.0    // Seconds from the response headers to the first byte of the body.
+#define S3DH_STALL_MIN_THROUGHPUT       4096    // Bytes per second a streaming block must sustain over a window.
+#define S3DH_STALL_WINDOW               10.0    // Seconds the throughput of a streaming block is measured over.
+#define S3DH_STALL_TICK                 1.0     // Seconds between checks of the blocks in flight.
+
+// Phase a block was found stalled in.
+typedef enum{
+    S3DH_STALL_NONE = 0,        // The block is progressing.
+    S3DH_STALL_CONNECT,         // No response headers within the connect timeout.
+    S3DH_STALL_FIRST_BYTE,      // Response headers but no body within the first byte timeout.
+    S3DH_STALL_THROUGHPUT       // Body arriving slower than the throughput floor over a whole window.
+} S3DH_STALL_REASON;
+
+/** Decides when a block request in flight has stalled from the byte counts its delegate callbacks record
+    rather than from wall time alone, so a large block on a slow but working link is left to finish while
+    a connection that has gone quiet is abandoned within one window. The helper checks its blocks every
+    S3DH_STALL_TICK seconds on the engine thread.
+ */
+@interface S3StallDetector : NSObject
+
+- (id)initWithConnectTimeout:(NSTimeInterval)connect firstByteTimeout:(NSTimeInterval)firstByte minThroughput:(double)throughput window:(NSTimeInterval)window;
+
+/** Checks a block at time now, advancing its throughput window once a window has elapsed. Blocks that
+    have not been issued yet are never stalled.
+ */
+- (S3DH_STALL_REASON)checkBlock:(S3BlockRequest*)block atTime:(NSTimeInterval)now;
+
+@property (nonatomic, assign)   NSTimeInterval  connectTimeout;     // Seconds allowed to the response headers.
+@property (nonatomic, assign)   NSTimeInterval  firstByteTimeout;   // Seconds allowed from the headers to the first body byte.
+@property (nonatomic, assign)   double          minThroughput;      // Bytes per second floor for a streaming block.
+@property (nonatomic, assign)   NSTimeInterval  window;             // Seconds the throughput is measured over.
+
+@end
@@ -0,0 +1,86 @@
+//
+//  S3StallDetector.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 22/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3StallDetector.h"
+#import "S3BlockRequest.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3StallDetector ()
+{
+    NSTimeInterval          _connectTimeout;            // Seconds allowed to the response headers.
+    NSTimeInterval          _firstByteTimeout;          // Seconds allowed from the headers to the first body byte.
+    double                  _minThroughput;             // Bytes per second floor for a streaming block.
+    NSTimeInterval          _window;                    // Seconds the throughput is measured over.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3StallDetector
+
+@synthesize connectTimeout      = _connectTimeout;
+@synthesize firstByteTimeout    = _firstByteTimeout;
+@synthesize minThroughput       = _minThroughput;
+@synthesize window              = _window;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)init
+{
+    return [self initWithConnectTimeout: S3DH_STALL_CONNECT_TIMEOUT firstByteTimeout: S3DH_STALL_FIRST_BYTE_TIMEOUT
+                          minThroughput: S3DH_STALL_MIN_THROUGHPUT window: S3DH_STALL_WINDOW ];
+}
+
+- (id)initWithConnectTimeout:(NSTimeInterval)connect firstByteTimeout:(NSTimeInterval)firstByte minThroughput:(double)throughput window:(NSTimeInterval)window
+{
+    self = [super init];
+    if( self ){
+        _connectTimeout     = connect;
+        _firstByteTimeout   = firstByte;
+        _minThroughput      = throughput;
+        _window             = window;
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (S3DH_STALL_REASON)checkBlock:(S3BlockRequest*)block atTime:(NSTimeInterval)now
+{
+    // Still waiting for its bandwidth reservation, the request has not been issued.
+    if( block.startTime == 0 ) return S3DH_STALL_NONE;
+
+    if( block.firstByteTime == 0 ){
+        return ( now - block.startTime > _connectTimeout ) ? S3DH_STALL_CONNECT : S3DH_STALL_NONE;
+    }
+    if( block.firstDataTime == 0 ){
+        return ( now - block.firstByteTime > _firstByteTimeout ) ? S3DH_STALL_FIRST_BYTE : S3DH_STALL_NONE;
+    }
+
+    // Measure the body over whole windows, starting the first window at the first body byte.
+    if( block.windowStart == 0 ){
+        block.windowStart       = block.firstDataTime;
+        block.windowReceived    = 0;
+    }
+    NSTimeInterval elapsed = now - block.windowStart;
+    if( elapsed < _window ) return S3DH_STALL_NONE;
+
+    double throughput = ( block.received - block.windowReceived ) / elapsed;
+    if( throughput < _minThroughput ) return S3DH_STALL_THROUGHPUT;
+
+    block.windowStart       = now;
+    block.windowReceived    = block.received;
+    return S3DH_STALL_NONE;
+}
+
+@end
@@ -13,6 +13,14 @@
 #import "Reachability.h"
 
 #import "S3RequestHelperDelegateProtocol.h"
+#import "S3TransferEngine.h"
+#import "S3RetryPolicy.h"
+#import "S3LatencyTracker.h"
+#import "S3ProgressReporter.h"
+#import "S3BandwidthLimiter.h"
+#import "S3TransferScheduler.h"
+#import "S3SyncManifest.h"
+#import "S3BucketLister.h"
 
 #import <CommonCrypto/CommonDigest.h>
 #import "Constants.h"
@@ -33,14 +41,76 @@
 -(void)includeAll;
 -(void)synchronise;
 
+/** Sets the priority the object at key is queued with, overriding priorityBlock. An object that is already queued moves to the
+    new priority without losing the time it has waited. May be called from any thread.
+ */
+-(void)setPriority:(S3DH_PRIORITY)priority forKey:(NSString*)key;
+
 @property (strong, atomic) Reachability             *bucketReachability;
 @property (atomic, readonly) SYNC_STATUS            status;
 
+/** Engine used for listing and for every S3RequestHelper of this bucket, defaults to the shared engine.
+ */
+@property (strong, atomic) S3TransferEngine         *engine;
+
+/** Backoff and retry budget shared by every S3RequestHelper of this bucket, the delays and budget can be changed at runtime from
+    the engine thread.
+ */
+@property (strong, atomic, readonly) S3RetryPolicy  *retryPolicy;
+
+/** Durations of recently completed blocks across every S3RequestHelper of this bucket, used to decide when a block is slow enough
+    to hedge.
+ */
+@property (strong, atomic, readonly) S3LatencyTracker *latencyTracker;
+
+/** Bandwidth cap shared by every S3RequestHelper of this bucket, unlimited by default. The rate and burst can be changed from any
+    thread while the bucket is synchronising, and the waits and totalWait counters report how long block requests were held back.
+ */
+@property (strong, atomic, readonly) S3BandwidthLimiter *bandwidthLimiter;
+
+/** Admits the S3RequestHelpers of this bucket to download at most S3DH_MAX_ACTIVE_TRANSFERS objects and S3DH_MAX_BYTES_IN_FLIGHT
+    bytes at a time, starting the next queued helper as each one finishes. The limits can be changed from the engine thread.
+ */
+@property (strong, atomic, readonly) S3TransferScheduler *transferScheduler;
+
+/** Lists the bucket over several prefix partitions at once, handing the pages over in key order. Prefixes set in its
+    excludedPrefixes are never listed, objects already downloaded under them are cancelled by the next listing. The prefixes and
+    concurrency can be changed from the engine thread and apply from the next listing.
+ */
+@property (strong, atomic, readonly) S3BucketLister *bucketLister;
+
+/** Record of the objects saved from this bucket, kept in Application Support and shared by every S3RequestHelper of the bucket so
+    that resets compare the listing with the manifest instead of hashing every local file.
+ */
+@property (strong, atomic, readonly) S3SyncManifest *manifest;
+
+/** Chooses the priority of each object without one set by setPriority:forKey:, from its key, size and the prefix of the key up to
+    the last "/". Called on the engine thread each time an object is queued. If nil every object is S3DH_PRIORITY_NORMAL.
+ */
+@property (copy, atomic) S3DH_PRIORITY (^priorityBlock)(NSString *key, int64_t size, NSString *prefix);
+
+/** Queue the S3downloadHelperDelegateProtocol callbacks are delivered on, defaults to the main queue.
+ */
+@property (strong, atomic) dispatch_queue_t         callbackQueue;
+
+/** Publishes the progress of every object of the bucket to the delegate progressDidUpdate: method as one snapshot per tick, at most
+    S3DH_PROGRESS_RATE times a second. The rate can be changed from the engine thread and applies from the next synchronise.
+ */
+@property (strong, atomic, readonly) S3ProgressReporter *progressReporter;
+
+/** Part size the bucket objects were uploaded with, passed to each S3RequestHelper to validate multipart ETags. Defaults to 0,
+    which infers the part size per object.
+ */
+@property (assign, atomic) int64_t                  multipartPartSize;
+
 
 
 // S3RequestHandlerDelegateProtocol
 
-- (void)progressChanged:(S3RequestHelper*)s3rh;
+/** Deprecated, the helper's progress is published with the other objects of the bucket in the next progressDidUpdate: snapshot.
+    Kept so existing callers and subclasses still build, it only brings the progress reporter up to date with the helper.
+ */
+- (void)progressChanged:(S3RequestHelper*)s3rh __attribute__((deprecated("Use the S3downloadHelperDelegate progressDidUpdate: snapshots")));
 
 - (NSString*)downloadPath:(S3RequestHelper*)s3rh;
 - (NSString*)persistPath:(S3RequestHelper*)s3rh;
@@ -51,6 +121,7 @@
 
 - (void)downloadFinished:( S3RequestHelper * )s3rh;
 - (void)downloadFailed:( S3RequestHelper * )s3rh;
+- (void)verificationFinished:( S3RequestHelper * )s3rh;
 
 +(NSString*)md5:(NSString*)path;
 
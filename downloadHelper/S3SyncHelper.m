@@ -8,12 +8,17 @@
 
 #import "S3SyncHelper.h"
 #import "S3RequestHelper.h"
+#import "S3ObjectDigest.h"
+#import "S3RetryPolicy.h"
+#import "S3ListingDiff.h"
 #import "S3downloadHelperDelegateProtocol.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Module Definitions
 // ---------------------------------------------------------------------------------------------------------------------
 #define S3DH_RHANDLER_DOMAIN @"co.c-works.s3dh.s3sh"
+#define S3DH_RESTART_LIMIT 3                // Times a failed download is restarted before the helper is left FAILED.
+#define S3DH_MANIFEST_FLUSH_TIMEOUT 2.0     // Seconds the app waits for the manifest to be written on background or terminate.
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Interface Definition
@@ -26,8 +31,11 @@
 
     int                 _retryTime;
     
-    NSArray             *_S3BucketObjectList;
     NSMutableDictionary *_S3RequestHelpers;
+    NSArray             *_listedSummaries;              // Summaries of the last listing in key order, compared with the next.
+    S3ListingDiff       *_listingDiff;                  // Compares the listing in progress with the last, nil when none is.
+    BOOL                _listingChanged;                // True once the listing in progress has added, changed or removed an object.
+    BOOL                _listingNotified;               // True once the listing in progress has reported a change.
     
     NSMutableDictionary *_S3ActiveHelpers;
     NSMutableDictionary *_S3SleepingHelpers;
@@ -35,6 +43,19 @@
     NSMutableDictionary *_S3ObjectSummaries;
 
     Reachability        *_bucketReachability;           // Reachability status for the specified bucked and location.
+    S3TransferEngine    *_engine;                       // Engine that runs listing, requests and all helper callbacks.
+    S3RetryPolicy       *_retryPolicy;                  // Backoff and retry budget shared by all helpers.
+    S3LatencyTracker    *_latencyTracker;               // Recent block durations shared by all helpers.
+    S3BandwidthLimiter  *_bandwidthLimiter;             // Token bucket capping the bandwidth of all helpers.
+    S3TransferScheduler *_transferScheduler;            // Admits helpers to download a few at a time.
+    S3BucketLister      *_bucketLister;                 // Lists the bucket in key order over several partitions at once.
+    S3SyncManifest      *_manifest;                     // Record of the objects saved from the bucket.
+    NSMutableDictionary *_priorities;                   // Key to NSNumber S3DH_PRIORITY set for that object.
+    NSMutableDictionary *_restarts;                     // Key to NSNumber of restarts since the object last downloaded.
+    S3DH_PRIORITY       (^_priorityBlock)(NSString*, int64_t, NSString*); // Chooses the priority of objects without one set.
+    S3ProgressReporter  *_progressReporter;             // Publishes aggregated progress snapshots to the delegate.
+    dispatch_queue_t    _callbackQueue;                 // Queue that delegate callbacks are delivered on.
+    int64_t             _multipartPartSize;             // Part size passed to each helper, 0 to infer per object.
     SYNC_STATUS         _status;
     Boolean             _isEnabled;
 }
@@ -50,6 +71,17 @@
 // ---------------------------------------------------------------------------------------------------------------------
 @synthesize bucketReachability  = _bucketReachability;
 @synthesize status              = _status;
+@synthesize engine              = _engine;
+@synthesize retryPolicy         = _retryPolicy;
+@synthesize latencyTracker      = _latencyTracker;
+@synthesize bandwidthLimiter    = _bandwidthLimiter;
+@synthesize transferScheduler   = _transferScheduler;
+@synthesize bucketLister        = _bucketLister;
+@synthesize manifest            = _manifest;
+@synthesize priorityBlock       = _priorityBlock;
+@synthesize progressReporter    = _progressReporter;
+@synthesize callbackQueue       = _callbackQueue;
+@synthesize multipartPartSize   = _multipartPartSize;
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Initialisation Methods
@@ -66,39 +98,73 @@
         _retryTime     = DEFAULT_RETRY_TIME;
         _status        = dhINITIALISED;
         _isEnabled     = YES;
+        _engine        = [S3TransferEngine sharedEngine];
+        _callbackQueue = dispatch_get_main_queue();
 
         _S3ActiveHelpers    = [[NSMutableDictionary alloc] init];
         _S3SleepingHelpers  = [[NSMutableDictionary alloc] init];
 
         _S3RequestHelpers   = [[NSMutableDictionary alloc] init];
         _S3ObjectSummaries  = [[NSMutableDictionary alloc] init];
+        _priorities         = [[NSMutableDictionary alloc] init];
+        _restarts           = [[NSMutableDictionary alloc] init];
         
         // Get the bucket host for reachability observer from a urlRequest object
         S3GetPreSignedURLRequest *urlRequest = [[S3GetPreSignedURLRequest alloc] init];
         urlRequest.bucket = _bucket;
         urlRequest.endpoint = _s3.endpoint;
         NSString *bucketURL = urlRequest.host;
+
+        _retryPolicy    = [[S3RetryPolicy alloc] init];
+        _latencyTracker = [[S3LatencyTracker alloc] init];
+        _bandwidthLimiter = [[S3BandwidthLimiter alloc] initWithRate: S3DH_BANDWIDTH_UNLIMITED burst: S3DH_BANDWIDTH_BURST engine: _engine ];
+        _transferScheduler = [[S3TransferScheduler alloc] initWithEngine: _engine maxActiveTransfers: S3DH_MAX_ACTIVE_TRANSFERS
+                                                        maxBytesInFlight: S3DH_MAX_BYTES_IN_FLIGHT ];
+        _bucketLister = [[S3BucketLister alloc] initWithS3Client: _s3 bucket: _bucket engine: _engine ];
+
+        NSString *support = [NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES) objectAtIndex: 0 ];
+        NSString *manifestPath = [[support stringByAppendingPathComponent: @"S3downloadHelper"]
+                                  stringByAppendingPathComponent: [_bucket stringByAppendingPathExtension: @"manifest"]];
+        _manifest = [[S3SyncManifest alloc] initWithPath: manifestPath engine: _engine ];
+
+        // Changes still waiting for the manifest's save delay would be lost if the app were suspended or killed first.
+        NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+        [center addObserver: self selector: @selector(flushManifest:) name: UIApplicationDidEnterBackgroundNotification object: nil ];
+        [center addObserver: self selector: @selector(flushManifest:) name: UIApplicationWillTerminateNotification object: nil ];
+
+        __weak typeof(self) weakSelf = self;
+        _progressReporter = [[S3ProgressReporter alloc] initWithEngine: _engine rate: S3DH_PROGRESS_RATE
+            helpers:^NSArray *{
+                return weakSelf.transferScheduler.activeHelpers;
+            }
+            handler:^(S3ProgressSnapshot *snapshot) {
+                [weakSelf notifyProgress: snapshot];
+            }];
         
         _bucketReachability = [Reachability reachabilityWithHostname: bucketURL ];
         _bucketReachability.reachableOnWWAN = YES;
         
-        __weak typeof(self) weakSelf = self;
         _bucketReachability.reachableBlock = ^(Reachability*reach){
             NSLog(@"S3 Bucket REACHABLE!");
-            [weakSelf performSelectorInBackground:@selector(updateRequestHelpers) withObject:nil];
+            [weakSelf updateRequestHelpers];
             
 //            [weakSelf isReachable ];
         };
         
         _bucketReachability.unreachableBlock = ^(Reachability*reach){
             NSLog(@"S3 Bucket UNREACHABLE!");
-            [weakSelf isUnreachable];
+            [weakSelf.engine performBlock:^{ [weakSelf isUnreachable]; }];
         };
         [_bucketReachability startNotifier];
     }
     return self;
 }
 
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver: self ];
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Public Control Methods
 // ---------------------------------------------------------------------------------------------------------------------
@@ -112,95 +178,241 @@
         for( NSString *key in _S3RequestHelpers ){
             S3RequestHelper *s3rh = [_S3RequestHelpers objectForKey:key  ];
             [s3rh suspend];
+            [_progressReporter updateHelper: s3rh ];
         }
+        [_transferScheduler removeAllHelpers];
+        [_bucketLister cancel];
+        [self abandonBucketList];
+        [_manifest save];
     }
 }
 
-// Fetches the latest bucket list and updates the S3RequestHanlers dictionary.
+// Lists the bucket through the bucket lister, which hands over each page in key order as soon as the pages before it have been
+// handed over, so new objects are queued for download while later partitions are still being listed.
 -(void)updateRequestHelpers{
-    NSError *error;
-    
+
+    // Helper state is owned by the engine thread.
+    if( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self updateRequestHelpers]; }];
+        return;
+    }
+
     [_s3 setConnectionTimeout: (NSTimeInterval) 60.0 ];
+    [self beginBucketList];
+
+    __weak typeof(self) weakSelf = self;
+    [_bucketLister listWithPageHandler:^(NSArray *summaries) {
+        [weakSelf processBucketPage: summaries];
+    }
+    completion:^(BOOL succeeded) {
+        if( succeeded ) [weakSelf finishBucketList];
+        else [weakSelf failBucketList];
+    }];
+}
+
+// Starts comparing a new listing with the last one. A listing that is replaced first keeps what its diff has already applied, so
+// the new diff does not report the same changes again. The new diff takes over the last listing.
+-(void)beginBucketList{
+    [self abandonBucketList];
+
+    __weak typeof(self) weakSelf = self;
+    _listingDiff        = [[S3ListingDiff alloc] initWithSummaries: _listedSummaries handler:^(S3DH_KEY_DIFF diff, S3ObjectSummary *S3summary) {
+        [weakSelf applyDiff: diff summary: S3summary ];
+    }];
+    _listedSummaries    = nil;
+    _listingChanged     = false;
+    _listingNotified    = false;
+}
+
+// Diffs one page against the last listing, runs on the engine thread so helpers are only touched there. Folder placeholders are
+// never synchronised so they are left out of the listing altogether.
+-(void)processBucketPage:(NSArray*)summaries{
+    if( ! _listingDiff ) return;
+
+    NSMutableArray *objects = [[NSMutableArray alloc] initWithCapacity: [summaries count] ];
+    for( S3ObjectSummary *S3summary in summaries ){
+        if( ! [S3summary.key hasSuffix: @"/" ] ) [objects addObject: S3summary ];
+    }
+    [_listingDiff diffPage: objects ];
+    [self bucketListDidChange];
+}
 
-    @try{
-        _S3BucketObjectList = [_s3 listObjectsInBucket: _bucket ];
+// Objects the complete listing did not reach are gone from the bucket, including those now under an excluded prefix.
+-(void)finishBucketList{
+    if( ! _listingDiff ) return;
+
+    [_listingDiff finish];
+    [self bucketListDidChange];
+    [self abandonBucketList];
+}
+
+-(void)failBucketList{
+    [self abandonBucketList];
+    if( [_delegate respondsToSelector: @selector(bucketListUpdateFailed:)] ){
+        [self notifyDelegate:^{ [_delegate bucketListUpdateFailed:self]; }];
     }
-    @catch ( AmazonServiceException *serviceException ) {
-        NSLog(@"Service Exception Occured: %@", serviceException.errorCode);
-        [_delegate bucketListUpdateFailed:self];
+}
+
+// Keeps the listing as far as it got, objects it passed over have already been removed and those it did not reach are kept.
+-(void)abandonBucketList{
+    if( ! _listingDiff ) return;
+
+    _listedSummaries    = _listingDiff.summaries;
+    _listingDiff        = nil;
+}
+
+// Creates a helper for each added object and replaces the helper of a changed one, queueing it straight away while the bucket is
+// synchronising. Removed objects have their helper cancelled. A listed object without a helper, such as one dropped after it
+// changed during download, is treated as added.
+-(void)applyDiff:(S3DH_KEY_DIFF)diff summary:(S3ObjectSummary*)S3summary{
+    S3RequestHelper *s3rh = [_S3RequestHelpers objectForKey: S3summary.key ];
+
+    switch (diff) {
+        case S3DH_KEY_ADDED:
+        case S3DH_KEY_UNCHANGED:
+            if( s3rh.state == FAILED ) [self restartFailedHelper: s3rh ];
+            if( s3rh ) return;
+            break;
+        case S3DH_KEY_CHANGED:
+            break;
+        case S3DH_KEY_REMOVED:
+            if( ! s3rh ) return;
+            [self removeRequestHelperForKey: S3summary.key ];
+            _listingChanged = true;
+            return;
     }
-    @catch (AmazonClientException *clientException) {
-        NSLog(@"Client Exception Occured: %@", clientException.error.localizedDescription);
-        [_delegate bucketListUpdateFailed:self];
+
+    if( s3rh ) [self removeRequestHelperForKey: S3summary.key ];
+    s3rh = [self requestHelperForSummary: S3summary ];
+    [_S3RequestHelpers setObject: s3rh forKey: S3summary.key ];
+    [_progressReporter addHelper: s3rh ];
+    _listingChanged = true;
+
+    if( _status == dhSYNCHRONISING ){
+        [_transferScheduler enqueueHelper: s3rh priority: [self priorityForHelper: s3rh ] ];
+        [_progressReporter start];
     }
-    @finally {
-        
-        BOOL bucketlistDidChange = false;
-        
-        // Clear Object Summaries and process S3ObjectList for non folder items.
-        NSMutableDictionary *S3RefreshedHelpers = [[NSMutableDictionary alloc] init];
-        for( S3ObjectSummary *S3summary in _S3BucketObjectList ){
-            if( ! [S3summary.key hasSuffix: @"/" ] ){
-
-                S3RequestHelper *s3rh      = [ _S3RequestHelpers objectForKey: S3summary.key ];
-                if( !s3rh ){
-                    s3rh = [[S3RequestHelper alloc] initWithS3ObjectSummary:S3summary S3Client:_s3 bucket:_bucket delegate:self error:error];
-                    bucketlistDidChange = true;
-                }
-                [ S3RefreshedHelpers setObject: s3rh forKey: S3summary.key ];
-                [_S3RequestHelpers removeObjectForKey: S3summary.key ];
-            }
-        }
-        
-        // Cancel Orphans and update the request helpers list.
-        for (S3RequestHelper *s3rh in _S3RequestHelpers ) {
-            bucketlistDidChange = true;
-            [s3rh cancel];
-        }
-        _S3RequestHelpers = S3RefreshedHelpers;
+}
 
-        
-        switch (_status) {
-            case dhINITIALISED:
-                _status = dhUPDATED;
-                break;
-            case dhUPDATED:         break;
-            case dhSYNCHRONISED:    break;
-            case dhSYNCHRONISING:   break;
-            case dhSUSPENDED:       break;
-        }
+// A helper that ran out of retries or restarts is left FAILED, which the scheduler will not queue. A new listing or synchronise
+// gives it a fresh set of both, keeping any checkpointed blocks.
+-(void)restartFailedHelper:(S3RequestHelper*)s3rh{
+    if( s3rh.state != FAILED ) return;
+
+    [_restarts removeObjectForKey: s3rh.key ];
+    [s3rh reset];
+    [_progressReporter updateHelper: s3rh ];
+    if( _status == dhSYNCHRONISING ){
+        [_transferScheduler enqueueHelper: s3rh priority: [self priorityForHelper: s3rh ] ];
+        [_progressReporter start];
+    }
+}
+
+-(void)removeRequestHelperForKey:(NSString*)key{
+    S3RequestHelper *s3rh = [_S3RequestHelpers objectForKey: key ];
 
-        if(bucketlistDidChange){
-            [_delegate bucketlistDidUpdate];
+    [_transferScheduler removeHelper: s3rh ];
+    [_progressReporter removeHelper: s3rh ];
+    [s3rh cancel];
+    [_S3RequestHelpers removeObjectForKey: key ];
+    [_S3ActiveHelpers removeObjectForKey: key ];
+    [_S3SleepingHelpers removeObjectForKey: key ];
+    [_restarts removeObjectForKey: key ];
+}
+
+// Marks the bucket updated once the first page has arrived and tells the delegate about the first change of a listing, so it can
+// start synchronising while later pages are still being listed.
+-(void)bucketListDidChange{
+
+    switch (_status) {
+        case dhINITIALISED:
+            _status = dhUPDATED;
+            break;
+        case dhUPDATED:         break;
+        case dhSYNCHRONISED:    break;
+        case dhSYNCHRONISING:   break;
+        case dhSUSPENDED:       break;
+    }
+
+    if( _listingChanged && ! _listingNotified ){
+        _listingNotified = true;
+        if( [_delegate respondsToSelector: @selector(bucketlistDidUpdate)] ){
+            [self notifyDelegate:^{ [_delegate bucketlistDidUpdate]; }];
         }
-        
-        // Call the delegate and inform it that the bucklist update is ready.
-        
     }
 }
 
+// Creates the helper for a listed object, sharing the bucket's engine, budgets and limits. The helper reads the
+// manifest and part size from its delegate while it is created.
+-(S3RequestHelper*)requestHelperForSummary:(S3ObjectSummary*)S3summary{
+    NSError *error;
+
+    S3RequestHelper *s3rh = [[S3RequestHelper alloc] initWithS3ObjectSummary:S3summary S3Client:_s3 bucket:_bucket delegate:self error:error];
+    s3rh.engine = _engine;
+    s3rh.retryPolicy = _retryPolicy;
+    s3rh.latencyTracker = _latencyTracker;
+    s3rh.bandwidthLimiter = _bandwidthLimiter;
+    return s3rh;
+}
+
 -(void)synchronise{
+
+    // Helper state is owned by the engine thread.
+    if( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self synchronise]; }];
+        return;
+    }
     
     if( _status == dhUPDATED || _status == dhSYNCHRONISED ){
 
         _isEnabled = true;
         _status = dhSYNCHRONISING;
+
+        // Queue every helper, the scheduler starts them a few at a time as earlier downloads finish. Failed helpers are reset
+        // first so they are queued too.
         for( NSString *key in _S3RequestHelpers ){
             S3RequestHelper *s3rh      = [ _S3RequestHelpers objectForKey: key ];
-            [s3rh synchronise];
+            [self restartFailedHelper: s3rh ];
+            [_transferScheduler enqueueHelper: s3rh priority: [self priorityForHelper: s3rh ] ];
         }
+        [_progressReporter start];
         
     }
 
 }
 
 -(void)includeAll{
+
+    // Helper state is owned by the engine thread.
+    if( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self includeAll]; }];
+        return;
+    }
+
     for( NSString *key in _S3RequestHelpers ){
 
         [ self includeKey: key ];
     }
 }
 
+-(void)setPriority:(S3DH_PRIORITY)priority forKey:(NSString*)key{
+
+    // Helper state is owned by the engine thread.
+    if( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self setPriority: priority forKey: key]; }];
+        return;
+    }
+
+    [_priorities setObject: [NSNumber numberWithInt: priority] forKey: key];
+
+    // Move a waiting helper to its new priority, helpers that are not queued pick it up the next time they are.
+    S3RequestHelper *s3rh = [_S3RequestHelpers objectForKey: key];
+    if( s3rh ){
+        [_transferScheduler setPriority: priority forHelper: s3rh];
+        [_progressReporter start];
+    }
+}
+
 -(BOOL)includeKey:(NSString*)key{
     
     S3RequestHelper *s3rh = [ _S3RequestHelpers objectForKey: key ];
@@ -239,18 +451,36 @@
 
 -(BOOL)validateMD5forDownload:(S3RequestHelper*)s3rh{
 
-    return [ s3rh.md5 isEqualToString: [ S3SyncHelper md5: s3rh.downloadPath ] ];
+    // Use the digest hashed while streaming if it covers the file, only fall back to reading the file for downloads left by an
+    // earlier session. Called on a file worker thread, like validateMD5forPersist:.
+    NSString *digest = s3rh.downloadDigest;
+    if( ! digest ) digest = [ S3ObjectDigest digestOfFileAtPath: s3rh.downloadPath forETag: s3rh.md5 partSize: s3rh.multipartPartSize ];
+    return [ self helper: s3rh matchesDigest: digest ofFileAtPath: s3rh.downloadPath ];
 }
 
 -(BOOL)validateMD5forPersist:(S3RequestHelper*)s3rh{
     
-    return [ s3rh.md5 isEqualToString: [ S3SyncHelper md5: s3rh.persistPath ] ];
+    NSString *digest = [ S3ObjectDigest digestOfFileAtPath: s3rh.persistPath forETag: s3rh.md5 partSize: s3rh.multipartPartSize ];
+    return [ self helper: s3rh matchesDigest: digest ofFileAtPath: s3rh.persistPath ];
+}
+
+// A multipart ETag that no part size fits can not be checked by hashing, so a file of the listed length is accepted rather than
+// downloaded again in a loop that could never succeed. Every range was fetched with If-Match on the listed ETag.
+-(BOOL)helper:(S3RequestHelper*)s3rh matchesDigest:(NSString*)digest ofFileAtPath:(NSString*)path{
+    if( [digest isEqualToString: S3DH_DIGEST_UNVERIFIABLE ] ){
+        NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: nil ];
+        return attributes && (int64_t)[attributes fileSize] == s3rh.fileSize;
+    }
+    return [ s3rh.md5 isEqualToString: digest ];
 }
 
 -(void)downloadFinished:(S3RequestHelper *)s3rh{
     
     // Need persistence strategy.
+    [_restarts removeObjectForKey: s3rh.key ];
     [s3rh persist];
+    [_progressReporter updateHelper: s3rh ];
+    [_transferScheduler admitHelpers];
     
     BOOL downloadComplete   = true;
     BOOL downloadFailed     = true;
@@ -267,21 +497,74 @@
     
     if ( downloadFailed ){
         NSTimeInterval delay = 60 * 60 * _retryTime;
-        [self performSelector: @selector(synchroniseBucket) withObject: nil afterDelay: delay ];
+        __weak typeof(self) weakSelf = self;
+        [_engine performBlock:^{ [weakSelf synchronise]; } afterDelay: delay ];
     }
 }
 
 - (void)downloadFailed:( S3RequestHelper * )s3rh{
     
     NSLog(@"Download Failed Error: %@", s3rh.error.localizedDescription );
-    
+    [_progressReporter updateHelper: s3rh ];
+    [_transferScheduler admitHelpers];
+
+    // Restarting can't help until space is freed, or while the listing disagrees with S3 about the object's length, leave the
+    // helper FAILED rather than retry in a loop.
+    if( s3rh.error.code == S3DH_RHELPER_FILE_UNWRITABLE || s3rh.error.code == S3DH_RHELPER_SIZE_MISMATCH ) return;
+
+    // The listed ETag is stale, drop the helper and relist so a new helper is built from the current object summary. It is
+    // dropped from every collection, a stale helper left in the active or sleeping set would outlive its replacement.
+    if( s3rh.error.code == S3DH_RHELPER_OBJECT_CHANGED ){
+        [_S3RequestHelpers removeObjectForKey: s3rh.key ];
+        [_S3ActiveHelpers removeObjectForKey: s3rh.key ];
+        [_S3SleepingHelpers removeObjectForKey: s3rh.key ];
+        [_restarts removeObjectForKey: s3rh.key ];
+        [_transferScheduler removeHelper: s3rh ];
+        [_progressReporter removeHelper: s3rh ];
+        [self updateRequestHelpers];
+        return;
+    }
+
+    // Restarts are limited per object, once they run out the helper is left FAILED until the next listing or synchronise
+    // restarts it.
+    NSUInteger restarts = [[_restarts objectForKey: s3rh.key ] unsignedIntegerValue];
+    if( restarts >= S3DH_RESTART_LIMIT ) return;
+    [_restarts setObject: [NSNumber numberWithUnsignedInteger: restarts + 1 ] forKey: s3rh.key ];
+
+    // Queue the restart after a jittered backoff that continues on from the block retries, so helpers that failed together do not
+    // restart together, and that waits on the bucket's retry budget like any other retry. Reset keeps any checkpointed blocks.
     [s3rh reset];
-    [s3rh synchronise];
+    [_progressReporter updateHelper: s3rh ];
+    __weak typeof(self) weakSelf = self;
+    __weak S3RequestHelper *weakHelper = s3rh;
+    __weak S3TransferScheduler *weakScheduler = _transferScheduler;
+    __weak S3ProgressReporter *weakReporter = _progressReporter;
+    [_engine performBlock:^{
+        [weakScheduler enqueueHelper: weakHelper priority: [weakSelf priorityForHelper: weakHelper ] ];
+        [weakReporter start];
+    } afterDelay: [_retryPolicy delayForRetry: DEFAULT_RETRY_LIMIT + restarts + 1 ] ];
 }
 
+// Deprecated, the reporter's snapshots replace the per percent callback. Forwarded so the reporter reads the helper at once.
 - (void)progressChanged:(S3RequestHelper*)s3rh{
-    // Demo method, prints progress of a file to the log window. Progress changed is only called
-    NSLog(@"Download:%d%% [%@]", s3rh.progress, [[s3rh.key componentsSeparatedByString:@"/"] lastObject] );
+
+    // Reporter state is owned by the engine thread.
+    if( ! _engine.isEngineThread ){
+        [_engine performBlock:^{ [self progressChanged: s3rh ]; }];
+        return;
+    }
+    [_progressReporter updateHelper: s3rh ];
+}
+
+// A helper that was hashing a file left by an earlier session could not be queued, queue it now that it has settled.
+- (void)verificationFinished:( S3RequestHelper * )s3rh{
+
+    if( [_S3RequestHelpers objectForKey: s3rh.key ] != s3rh ) return;
+    [_progressReporter updateHelper: s3rh ];
+    if( _status == dhSYNCHRONISING ){
+        [_transferScheduler enqueueHelper: s3rh priority: [self priorityForHelper: s3rh ] ];
+        [_progressReporter start];
+    }
 }
 
 - (BOOL)persistFile:(S3RequestHelper*)s3rh{
@@ -303,6 +586,45 @@
 // Support Methods
 // ---------------------------------------------------------------------------------------------------------------------
 
+// Writes the manifest's pending changes on the engine thread, and waits a short while for the write so the app is not suspended
+// or terminated part way through it.
+-(void)flushManifest:(NSNotification*)notification{
+    if( _engine.isEngineThread ){
+        [_manifest save];
+        return;
+    }
+
+    dispatch_semaphore_t saved = dispatch_semaphore_create( 0 );
+    S3SyncManifest *manifest = _manifest;
+    [_engine performBlock:^{
+        [manifest save];
+        dispatch_semaphore_signal( saved );
+    }];
+    dispatch_semaphore_wait( saved, dispatch_time( DISPATCH_TIME_NOW, (int64_t)( S3DH_MANIFEST_FLUSH_TIMEOUT * NSEC_PER_SEC ) ) );
+}
+
+// A priority set for the key wins over the priority block, objects with neither are queued as normal.
+-(S3DH_PRIORITY)priorityForHelper:(S3RequestHelper*)s3rh{
+    NSNumber *priority = [_priorities objectForKey: s3rh.key];
+    if( priority ) return [priority intValue];
+    if( ! _priorityBlock ) return S3DH_PRIORITY_NORMAL;
+
+    NSRange slash = [s3rh.key rangeOfString: @"/" options: NSBackwardsSearch];
+    NSString *prefix = ( slash.location == NSNotFound ) ? @"" : [s3rh.key substringToIndex: NSMaxRange( slash )];
+    return _priorityBlock( s3rh.key, s3rh.fileSize, prefix );
+}
+
+// Passes a progress snapshot to the delegate if it wants them.
+-(void)notifyProgress:(S3ProgressSnapshot*)snapshot{
+    if( ! [_delegate respondsToSelector: @selector(progressDidUpdate:)] ) return;
+    [self notifyDelegate:^{ [_delegate progressDidUpdate: snapshot]; }];
+}
+
+// Delivers a delegate callback on the callback queue, so the delegate never sees engine or worker threads.
+-(void)notifyDelegate:(void (^)(void))callback{
+    dispatch_async( _callbackQueue, callback );
+}
+
 // Calculates an md5 for a specified path, reads incrementally to handle large files.
 +(NSString*)md5:(NSString*)path{
     
@@ -0,0 +1,74 @@
+//
+//  S3SyncManifest.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 26/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3TransferEngine;
+
+#define S3DH_MANIFEST_SAVE_DELAY    2.0     // Seconds changes are gathered before the manifest is written.
+#define S3DH_MANIFEST_VERSION       1       // Format of the manifest file, files of another version are ignored.
+
+/** What is known about the local copy of one key when it was last saved. The inode, modification time
+    and size identify the file on disk, so a file that has been replaced or edited since no longer
+    matches its entry.
+ */
+@interface S3ManifestEntry : NSObject
+
+- (id)initWithDictionary:(NSDictionary*)dictionary;
+
+/** Entry for the file at path, taking the inode, modification time and size from its attributes.
+    Returns nil if the file does not exist.
+ */
+- (id)initWithETag:(NSString*)etag lastModified:(NSString*)lastModified filePath:(NSString*)path verified:(BOOL)verified;
+
+/** True if the file at path is the same file, unchanged, that the entry was made from.
+ */
+- (BOOL)matchesFileAtPath:(NSString*)path;
+
+@property (nonatomic, readonly) NSString            *etag;          // ETag of the object the file was saved from.
+@property (nonatomic, readonly) int64_t             size;           // Size of the file in bytes.
+@property (nonatomic, readonly) NSString            *lastModified;  // Last modified time of the object from the listing.
+@property (nonatomic, readonly) uint64_t            inode;          // File system number of the file.
+@property (nonatomic, readonly) NSTimeInterval      mtime;          // Reference time the file was last modified.
+@property (nonatomic, readonly) BOOL                verified;       // True if the file contents were checked against the ETag.
+@property (nonatomic, readonly) NSDictionary        *dictionary;    // Property list form of the entry.
+
+@end
+
+/** On-disk record of the objects an S3SyncHelper has saved, keyed by object key. Reconciling a listing
+    against the manifest only compares ETags and sizes and reads file attributes, so startup cost follows
+    the number of changed objects rather than the bytes on disk. Files are only hashed when they have no
+    entry or no longer match their entry.
+
+    Changes are gathered for S3DH_MANIFEST_SAVE_DELAY seconds and written as one binary property list,
+    atomically by way of a temporary file, so a crash leaves either the old or the new manifest and never a
+    partial one. The owner should also save when the app is sent to the background or terminated, so the
+    changes still waiting for the delay are not lost. All methods must be called on the engine thread.
+ */
+@interface S3SyncManifest : NSObject
+
+/** Loads the manifest at path, starting empty if there is none or it can not be read.
+ */
+- (id)initWithPath:(NSString*)path engine:(S3TransferEngine*)engine;
+
+- (S3ManifestEntry*)entryForKey:(NSString*)key;
+
+/** Records the entry for key and schedules a save.
+ */
+- (void)setEntry:(S3ManifestEntry*)entry forKey:(NSString*)key;
+
+- (void)removeEntryForKey:(NSString*)key;
+
+/** Writes any pending changes now rather than after the save delay, does nothing if there are none.
+ */
+- (BOOL)save;
+
+@property (nonatomic, readonly) NSString            *path;          // File the manifest is kept in.
+@property (nonatomic, readonly) NSUInteger          count;          // Number of keys in the manifest.
+
+@end
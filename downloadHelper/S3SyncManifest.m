@@ -0,0 +1,205 @@
+//
+//  S3SyncManifest.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 26/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3SyncManifest.h"
+#import "S3TransferEngine.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// S3ManifestEntry
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3ManifestEntry ()
+{
+    NSString                *_etag;                     // ETag of the object the file was saved from.
+    int64_t                 _size;                      // Size of the file in bytes.
+    NSString                *_lastModified;             // Last modified time of the object from the listing.
+    uint64_t                _inode;                     // File system number of the file.
+    NSTimeInterval          _mtime;                     // Reference time the file was last modified.
+    BOOL                    _verified;                  // True if the file contents were checked against the ETag.
+}
+@end
+
+@implementation S3ManifestEntry
+
+@synthesize etag            = _etag;
+@synthesize size            = _size;
+@synthesize lastModified    = _lastModified;
+@synthesize inode           = _inode;
+@synthesize mtime           = _mtime;
+@synthesize verified        = _verified;
+
+- (id)initWithDictionary:(NSDictionary*)dictionary
+{
+    self = [super init];
+    if( self ){
+        if ( ! [dictionary isKindOfClass: [NSDictionary class]] ) return nil;
+        if ( ! ( _etag = [dictionary objectForKey: @"etag"] ) ) return nil;
+
+        _size           = [[dictionary objectForKey: @"size"] longLongValue];
+        _lastModified   = [dictionary objectForKey: @"lastModified"];
+        _inode          = [[dictionary objectForKey: @"inode"] unsignedLongLongValue];
+        _mtime          = [[dictionary objectForKey: @"mtime"] doubleValue];
+        _verified       = [[dictionary objectForKey: @"verified"] boolValue];
+    }
+    return self;
+}
+
+- (id)initWithETag:(NSString*)etag lastModified:(NSString*)lastModified filePath:(NSString*)path verified:(BOOL)verified
+{
+    self = [super init];
+    if( self ){
+        NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: nil ];
+        if ( ! attributes || ! ( _etag = etag ) ) return nil;
+
+        _size           = (int64_t)[attributes fileSize];
+        _lastModified   = lastModified;
+        _inode          = [attributes fileSystemFileNumber];
+        _mtime          = [[attributes fileModificationDate] timeIntervalSinceReferenceDate];
+        _verified       = verified;
+    }
+    return self;
+}
+
+- (BOOL)matchesFileAtPath:(NSString*)path
+{
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath: path error: nil ];
+    if ( ! attributes ) return false;
+
+    return (int64_t)[attributes fileSize] == _size && [attributes fileSystemFileNumber] == _inode &&
+           [[attributes fileModificationDate] timeIntervalSinceReferenceDate] == _mtime;
+}
+
+- (NSDictionary*)dictionary
+{
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                       _etag,                                                   @"etag",
+                                       [NSNumber numberWithLongLong: _size ],                   @"size",
+                                       [NSNumber numberWithUnsignedLongLong: _inode ],          @"inode",
+                                       [NSNumber numberWithDouble: _mtime ],                    @"mtime",
+                                       [NSNumber numberWithBool: _verified ],                   @"verified", nil ];
+    if ( _lastModified ) [dictionary setObject: _lastModified forKey: @"lastModified" ];
+    return dictionary;
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3SyncManifest ()
+{
+    NSString                *_path;                     // File the manifest is kept in.
+    S3TransferEngine        *_engine;                   // Engine the delayed save runs on.
+    NSMutableDictionary     *_entries;                  // Key to S3ManifestEntry.
+    BOOL                    _saveScheduled;             // True while changes are waiting for a delayed save.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3SyncManifest
+
+@synthesize path            = _path;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithPath:(NSString*)path engine:(S3TransferEngine*)engine
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _path   = path   ) ) return nil;
+        if ( ! ( _engine = engine ) ) return nil;
+
+        _entries = [[NSMutableDictionary alloc] init];
+        [self load];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (S3ManifestEntry*)entryForKey:(NSString*)key
+{
+    return [_entries objectForKey: key ];
+}
+
+- (void)setEntry:(S3ManifestEntry*)entry forKey:(NSString*)key
+{
+    if ( ! entry || ! key ) return;
+    [_entries setObject: entry forKey: key ];
+    [self scheduleSave];
+}
+
+- (void)removeEntryForKey:(NSString*)key
+{
+    if ( ! key || ! [_entries objectForKey: key ] ) return;
+    [_entries removeObjectForKey: key ];
+    [self scheduleSave];
+}
+
+- (BOOL)save
+{
+    if ( ! _saveScheduled ) return true;
+    _saveScheduled = NO;
+
+    NSMutableDictionary *entries = [[NSMutableDictionary alloc] initWithCapacity: [_entries count] ];
+    for ( NSString *key in _entries ) [entries setObject: [[_entries objectForKey: key ] dictionary] forKey: key ];
+
+    NSDictionary *manifest = [NSDictionary dictionaryWithObjectsAndKeys:
+                              [NSNumber numberWithInt: S3DH_MANIFEST_VERSION ], @"version",
+                              entries,                                          @"entries", nil ];
+
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList: manifest format: NSPropertyListBinaryFormat_v1_0 options: 0 error: nil ];
+    if ( ! data ) return false;
+
+    [[NSFileManager defaultManager] createDirectoryAtPath: [_path stringByDeletingLastPathComponent]
+                              withIntermediateDirectories: YES attributes: nil error: nil ];
+    return [data writeToFile: _path options: NSDataWritingAtomic error: nil ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)count         { return [_entries count];  }
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Reads the entries of a manifest of the current version, anything else is ignored and the manifest rebuilt as files are saved.
+- (void)load
+{
+    NSData *data = [NSData dataWithContentsOfFile: _path ];
+    if ( ! data ) return;
+
+    NSDictionary *manifest = [NSPropertyListSerialization propertyListWithData: data options: NSPropertyListImmutable format: NULL error: nil ];
+    if ( ! [manifest isKindOfClass: [NSDictionary class]] ) return;
+    if ( [[manifest objectForKey: @"version"] intValue] != S3DH_MANIFEST_VERSION ) return;
+
+    NSDictionary *entries = [manifest objectForKey: @"entries"];
+    if ( ! [entries isKindOfClass: [NSDictionary class]] ) return;
+
+    for ( NSString *key in entries ) {
+        S3ManifestEntry *entry = [[S3ManifestEntry alloc] initWithDictionary: [entries objectForKey: key ] ];
+        if ( entry ) [_entries setObject: entry forKey: key ];
+    }
+}
+
+// Gathers the changes of a burst of saves into one write.
+- (void)scheduleSave
+{
+    if ( _saveScheduled ) return;
+    _saveScheduled = YES;
+
+    __weak S3SyncManifest *weakSelf = self;
+    [_engine performBlock:^{ [weakSelf save]; } afterDelay: S3DH_MANIFEST_SAVE_DELAY ];
+}
+
+@end
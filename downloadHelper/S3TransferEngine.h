@@ -0,0 +1,86 @@
+//
+//  S3TransferEngine.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 16/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#define S3DH_ENGINE_WORKERS 4               // Number of worker threads available for blocking work (listing).
+#define S3DH_ENGINE_FILE_WORKERS 2          // Number of worker threads available for reading whole files (hashing).
+
+/** Shared asynchronous transfer engine. Owns a single event loop thread with a running NSRunLoop, every
+    asynchronous S3 request is started on that thread so that the SDK connection, its delegate callbacks
+    and any timers are all serviced by the same loop. Blocking work such as bucket listing is submitted
+    to a bounded worker pool, and reads of whole files such as hashing to a second bounded pool so a
+    bucket of unchecked files can not hold up the listing. The number of threads used stays fixed
+    regardless of how many objects are being synchronised.
+ */
+@interface S3TransferEngine : NSObject
+
+///-------------------------------------------------------------------------------------------------
+/// @name Initialisation Methods
+///-------------------------------------------------------------------------------------------------
+
+/** Engine shared by all helpers, created on first use with S3DH_ENGINE_WORKERS workers.
+ */
++ (S3TransferEngine*)sharedEngine;
+
+- (id)initWithWorkerCount:(NSInteger)workers;
+
+///-------------------------------------------------------------------------------------------------
+/// @name Scheduling Methods
+///-------------------------------------------------------------------------------------------------
+
+/** Queues the block to run on the event loop thread, blocks run in the order they are submitted. The
+    block is always run asynchronously, even when called from the event loop thread.
+ */
+- (void)performBlock:(void (^)(void))block;
+
+/** Queues the block to run on the event loop thread once delay seconds have passed.
+ */
+- (void)performBlock:(void (^)(void))block afterDelay:(NSTimeInterval)delay;
+
+/** Queues the block on the bounded worker pool, use for work that would stall the event loop such as listing pages.
+    Results are handed back to the event loop with performBlock:.
+ */
+- (void)performWorkerBlock:(void (^)(void))block;
+
+/** Queues the block on the bounded file pool, use for long reads of local files such as hashing. Results are handed
+    back to the event loop with performBlock:.
+ */
+- (void)performFileBlock:(void (^)(void))block;
+
+/** Creates a timer and schedules it on the event loop run loop, may be called from any thread.
+ */
+- (NSTimer*)scheduledTimerWithTimeInterval:(NSTimeInterval)interval target:(id)target selector:(SEL)selector userInfo:(id)userInfo repeats:(BOOL)repeats;
+
+/** Creates a timer that calls the block and schedules it on the event loop run loop, may be called from any thread. The
+    timer retains only the block, so an owner the block captures weakly is not kept alive by a repeating timer. The owner
+    must still invalidate the timer when it stops or is deallocated.
+ */
+- (NSTimer*)scheduledTimerWithTimeInterval:(NSTimeInterval)interval repeats:(BOOL)repeats block:(void (^)(NSTimer *timer))block;
+
+///-------------------------------------------------------------------------------------------------
+/// @name Properties
+///-------------------------------------------------------------------------------------------------
+
+/** True when called on the event loop thread.
+ */
+@property (nonatomic, readonly) BOOL                isEngineThread;
+
+/** Event loop thread, all AmazonServiceRequestDelegate callbacks for engine requests arrive here.
+ */
+@property (nonatomic, readonly) NSThread            *thread;
+
+/** Maximum number of worker blocks run at once.
+ */
+@property (nonatomic, assign)   NSInteger           workerCount;
+
+/** Maximum number of file blocks run at once, defaults to S3DH_ENGINE_FILE_WORKERS.
+ */
+@property (nonatomic, assign)   NSInteger           fileWorkerCount;
+
+@end
@@ -0,0 +1,201 @@
+//
+//  S3TransferEngine.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 16/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3TransferEngine.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Module Definitions
+// ---------------------------------------------------------------------------------------------------------------------
+#define S3DH_ENGINE_THREAD_NAME @"co.c-works.s3dh.engine"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// S3TimerBlockTarget
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Target of a block timer, the timer retains it and it retains only the block.
+@interface S3TimerBlockTarget : NSObject
+{
+    void (^_block)(NSTimer*);                           // Called each time the timer fires.
+}
+- (id)initWithBlock:(void (^)(NSTimer *timer))block;
+- (void)timerFired:(NSTimer*)timer;
+@end
+
+@implementation S3TimerBlockTarget
+
+- (id)initWithBlock:(void (^)(NSTimer *timer))block
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _block = [block copy] ) ) return nil;
+    }
+    return self;
+}
+
+- (void)timerFired:(NSTimer*)timer
+{
+    _block( timer );
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3TransferEngine ()
+{
+    NSThread                *_thread;                   // Event loop thread running the engine run loop.
+    NSRunLoop               *_runLoop;                  // Run loop of the event loop thread, set once the thread starts.
+    NSCondition             *_started;                  // Signalled when the event loop thread is ready.
+    NSOperationQueue        *_workers;                  // Bounded pool for blocking work.
+    NSOperationQueue        *_fileWorkers;              // Bounded pool for reading whole files, kept apart from the listing.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3TransferEngine
+
+@synthesize thread          = _thread;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
++ (S3TransferEngine*)sharedEngine
+{
+    static S3TransferEngine *sharedEngine = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedEngine = [[S3TransferEngine alloc] initWithWorkerCount: S3DH_ENGINE_WORKERS ];
+    });
+    return sharedEngine;
+}
+
+- (id)initWithWorkerCount:(NSInteger)workers
+{
+    self = [super init];
+    if( self ){
+        _workers = [[NSOperationQueue alloc] init];
+        _workers.maxConcurrentOperationCount = MAX( workers, 1 );
+        _fileWorkers = [[NSOperationQueue alloc] init];
+        _fileWorkers.maxConcurrentOperationCount = S3DH_ENGINE_FILE_WORKERS;
+
+        _started = [[NSCondition alloc] init];
+        _thread  = [[NSThread alloc] initWithTarget: self selector: @selector(engineMain) object: nil ];
+        _thread.name = S3DH_ENGINE_THREAD_NAME;
+        [_thread start];
+
+        // Wait for the run loop to exist so that timers can be scheduled on it straight away.
+        [_started lock];
+        while ( _runLoop == nil ) [_started wait];
+        [_started unlock];
+    }
+    return self;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)performBlock:(void (^)(void))block
+{
+    [self performSelector: @selector(runBlock:) onThread: _thread withObject: [block copy] waitUntilDone: NO ];
+}
+
+- (void)performBlock:(void (^)(void))block afterDelay:(NSTimeInterval)delay
+{
+    void (^delayed)(void) = [block copy];
+    [self performBlock: ^{
+        [self performSelector: @selector(runBlock:) withObject: delayed afterDelay: delay ];
+    }];
+}
+
+- (void)performWorkerBlock:(void (^)(void))block
+{
+    [_workers addOperationWithBlock: block ];
+}
+
+- (void)performFileBlock:(void (^)(void))block
+{
+    [_fileWorkers addOperationWithBlock: block ];
+}
+
+- (NSTimer*)scheduledTimerWithTimeInterval:(NSTimeInterval)interval target:(id)target selector:(SEL)selector userInfo:(id)userInfo repeats:(BOOL)repeats
+{
+    NSTimer *timer = [NSTimer timerWithTimeInterval: interval target: target selector: selector userInfo: userInfo repeats: repeats ];
+
+    // NSRunLoop is not thread safe, so timers created off the loop are added through the CFRunLoop API.
+    CFRunLoopAddTimer( [_runLoop getCFRunLoop], (__bridge CFRunLoopTimerRef)timer, kCFRunLoopDefaultMode );
+    return timer;
+}
+
+- (NSTimer*)scheduledTimerWithTimeInterval:(NSTimeInterval)interval repeats:(BOOL)repeats block:(void (^)(NSTimer *timer))block
+{
+    S3TimerBlockTarget *target = [[S3TimerBlockTarget alloc] initWithBlock: block ];
+    return [self scheduledTimerWithTimeInterval: interval target: target selector: @selector(timerFired:) userInfo: nil repeats: repeats ];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (BOOL)isEngineThread
+{
+    return [NSThread currentThread] == _thread;
+}
+
+- (NSInteger)workerCount
+{
+    return _workers.maxConcurrentOperationCount;
+}
+
+- (void)setWorkerCount:(NSInteger)workerCount
+{
+    _workers.maxConcurrentOperationCount = MAX( workerCount, 1 );
+}
+
+- (NSInteger)fileWorkerCount
+{
+    return _fileWorkers.maxConcurrentOperationCount;
+}
+
+- (void)setFileWorkerCount:(NSInteger)fileWorkerCount
+{
+    _fileWorkers.maxConcurrentOperationCount = MAX( fileWorkerCount, 1 );
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Event loop thread entry point, a port keeps the run loop alive while there are no connections or timers.
+- (void)engineMain
+{
+    @autoreleasepool {
+        NSRunLoop *runLoop = [NSRunLoop currentRunLoop];
+        [runLoop addPort: [NSMachPort port] forMode: NSDefaultRunLoopMode ];
+
+        [_started lock];
+        _runLoop = runLoop;
+        [_started signal];
+        [_started unlock];
+    }
+
+    while ( YES ) {
+        @autoreleasepool {
+            [_runLoop runMode: NSDefaultRunLoopMode beforeDate: [NSDate distantFuture] ];
+        }
+    }
+}
+
+- (void)runBlock:(void (^)(void))block
+{
+    block();
+}
+// ---------------------------------------------------------------------------------------------------------------------
+
+@end
@@ -0,0 +1,88 @@
+//
+//  S3TransferScheduler.h
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 25/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class S3TransferEngine;
+@class S3RequestHelper;
+
+#define S3DH_MAX_ACTIVE_TRANSFERS   4           // Objects downloading at once.
+#define S3DH_MAX_BYTES_IN_FLIGHT    67108864    // Bytes still to download across the active objects, 64 MiB.
+#define S3DH_SCHEDULER_TICK         1.0         // Seconds between admission checks while helpers are queued.
+#define S3DH_PRIORITY_AGING         30.0        // Seconds a queued helper waits to be treated as one priority class higher.
+#define S3DH_STEAL_MIN_BYTES        8388608     // Unrequested bytes an active object needs before idle slots are lent to it, 8 MiB.
+
+typedef enum{
+    S3DH_PRIORITY_LOW = 0,                      // Background content, downloaded once nothing else is waiting.
+    S3DH_PRIORITY_NORMAL,                       // Default for every object.
+    S3DH_PRIORITY_HIGH,                         // Content the user is likely to open soon.
+    S3DH_PRIORITY_URGENT                        // Content the application needs before it can continue, such as indexes.
+} S3DH_PRIORITY;
+
+#define S3DH_PRIORITY_CLASSES       4           // Number of S3DH_PRIORITY classes.
+
+/** Admits the S3RequestHelpers of an S3SyncHelper to download a few at a time, so a large bucket does not
+    open a request and a file for every object at once. Queued helpers are started while fewer than
+    maxActiveTransfers are downloading and the bytes the active helpers still have to download stay within
+    maxBytesInFlight. An object larger than maxBytesInFlight is started once
+    nothing else is active.
+
+    Each helper is queued in an S3DH_PRIORITY class and the highest class is admitted first, first come first
+    served within a class. A helper is treated as one class higher for every agingInterval it has waited, so
+    a steady stream of high priority work can delay low priority work but not starve it.
+
+    Once the queue is empty the slots left idle are lent to the active objects with the most bytes still to
+    request, each slot adding the object's parallelRanges to its borrowedRanges, so the last large objects
+    of a sync are fetched on several streams instead of one. Loans are recalculated on every admission and
+    taken back as soon as another helper is queued.
+
+    A helper stops counting as active as soon as it leaves the DOWNLOADING state, the next helper is admitted
+    when admitHelpers is called from the delegate callbacks, or at the next tick for helpers that suspended
+    themselves. All methods must be called on the engine thread.
+ */
+@interface S3TransferScheduler : NSObject
+
+- (id)initWithEngine:(S3TransferEngine*)engine maxActiveTransfers:(NSUInteger)maxActive maxBytesInFlight:(int64_t)maxBytes;
+
+/** Queues a helper that is INITIALISED or SUSPENDED at S3DH_PRIORITY_NORMAL, then admits helpers up to the
+    limits. Helpers already queued or active are ignored.
+ */
+- (void)enqueueHelper:(S3RequestHelper*)helper;
+
+/** Queues a helper in the given priority class, a helper that is already queued is moved to the class and keeps
+    the time it has waited.
+ */
+- (void)enqueueHelper:(S3RequestHelper*)helper priority:(S3DH_PRIORITY)priority;
+
+/** Moves a queued helper to the given priority class, keeping the time it has waited. Helpers that are not
+    queued are ignored.
+ */
+- (void)setPriority:(S3DH_PRIORITY)priority forHelper:(S3RequestHelper*)helper;
+
+/** Removes a helper from the queue or the active list without changing its state.
+ */
+- (void)removeHelper:(S3RequestHelper*)helper;
+
+/** Empties the queue and the active list without changing the state of their helpers.
+ */
+- (void)removeAllHelpers;
+
+/** Drops active helpers that are no longer downloading and starts queued helpers up to the limits.
+ */
+- (void)admitHelpers;
+
+@property (nonatomic, assign)   NSUInteger      maxActiveTransfers; // Most helpers downloading at once.
+@property (nonatomic, assign)   int64_t         maxBytesInFlight;   // Most bytes left to download across the active helpers.
+@property (nonatomic, assign)   NSTimeInterval  agingInterval;      // Seconds waited per class of promotion, 0 disables aging.
+@property (nonatomic, readonly) NSUInteger      activeCount;        // Helpers admitted and still downloading.
+@property (nonatomic, readonly) NSArray         *activeHelpers;     // Helpers admitted and still downloading, in admission order.
+@property (nonatomic, readonly) NSUInteger      queuedCount;        // Helpers waiting to be admitted.
+@property (nonatomic, readonly) int64_t         bytesInFlight;      // Bytes left to download across the active helpers.
+@property (nonatomic, readonly) NSUInteger      lentSlots;          // Idle slots currently lent to active helpers.
+
+@end
@@ -0,0 +1,307 @@
+//
+//  S3TransferScheduler.m
+//  downloadHelper
+//
+//  Created by Jonathan Dring on 25/09/2013.
+//  Copyright (c) 2013 Jonathan Dring. All rights reserved.
+//
+
+#import "S3TransferScheduler.h"
+#import "S3TransferEngine.h"
+#import "S3RequestHelper.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Interface Definition
+// ---------------------------------------------------------------------------------------------------------------------
+@interface S3TransferScheduler ()
+{
+    S3TransferEngine        *_engine;                   // Engine the admission timer runs on.
+    NSUInteger              _maxActiveTransfers;        // Most helpers downloading at once.
+    int64_t                 _maxBytesInFlight;          // Most bytes left to download across the active helpers.
+    NSTimeInterval          _agingInterval;             // Seconds waited per class of promotion, 0 disables aging.
+
+    NSArray                 *_queues;                   // One queue per priority class, each entry an array of helper, time queued and class.
+    NSMutableSet            *_queued;                   // Helpers in any of the queues.
+    NSMutableArray          *_active;                   // Helpers admitted to download.
+    NSTimer                 *_timer;                    // Admission check while helpers are queued or slots are lent, nil otherwise.
+    NSUInteger              _lentSlots;                 // Idle slots currently lent to active helpers.
+    BOOL                    _admitting;                 // True while admitHelpers is starting helpers.
+}
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Class Implementation
+// ---------------------------------------------------------------------------------------------------------------------
+@implementation S3TransferScheduler
+
+@synthesize agingInterval   = _agingInterval;
+@synthesize lentSlots       = _lentSlots;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Initialisation Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (id)initWithEngine:(S3TransferEngine*)engine maxActiveTransfers:(NSUInteger)maxActive maxBytesInFlight:(int64_t)maxBytes
+{
+    self = [super init];
+    if( self ){
+        if ( ! ( _engine = engine ) ) return nil;
+
+        _maxActiveTransfers = MAX( maxActive, 1 );
+        _maxBytesInFlight   = MAX( maxBytes, 0 );
+        _agingInterval      = S3DH_PRIORITY_AGING;
+        _queued             = [[NSMutableSet alloc] init];
+
+        NSMutableArray *queues = [[NSMutableArray alloc] init];
+        for ( NSUInteger i = 0; i < S3DH_PRIORITY_CLASSES; i++ ) [queues addObject: [[NSMutableArray alloc] init] ];
+        _queues             = queues;
+        _active             = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_timer invalidate];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Public Control Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (void)enqueueHelper:(S3RequestHelper*)helper
+{
+    [self enqueueHelper: helper priority: S3DH_PRIORITY_NORMAL ];
+}
+
+- (void)enqueueHelper:(S3RequestHelper*)helper priority:(S3DH_PRIORITY)priority
+{
+    if ( ! helper || [_active containsObject: helper ] ) return;
+    if ( helper.state != INITIALISED && helper.state != SUSPENDED ) return;
+
+    NSNumber *queuedAt = [NSNumber numberWithDouble: [NSDate timeIntervalSinceReferenceDate] ];
+    if ( [_queued containsObject: helper ] ){
+        NSArray *entry = [self entryForHelper: helper ];
+        queuedAt = [entry objectAtIndex: 1 ];
+        [self removeEntry: entry ];
+    }
+
+    // Keep each queue in the order helpers were first queued, so a moved helper does not lose its place to newer ones.
+    NSUInteger level        = MIN( (NSUInteger)MAX( priority, 0 ), S3DH_PRIORITY_CLASSES - 1 );
+    NSMutableArray *queue   = [_queues objectAtIndex: level ];
+    NSUInteger index        = [queue count];
+    while ( index > 0 && [[[queue objectAtIndex: index - 1 ] objectAtIndex: 1 ] doubleValue] > [queuedAt doubleValue] ) index--;
+
+    [queue insertObject: [NSArray arrayWithObjects: helper, queuedAt, [NSNumber numberWithUnsignedInteger: level ], nil ] atIndex: index ];
+    [_queued addObject: helper ];
+    [self admitHelpers];
+}
+
+- (void)setPriority:(S3DH_PRIORITY)priority forHelper:(S3RequestHelper*)helper
+{
+    if ( [_queued containsObject: helper ] ) [self enqueueHelper: helper priority: priority ];
+}
+
+- (void)removeHelper:(S3RequestHelper*)helper
+{
+    if ( [_queued containsObject: helper ] ) [self removeEntry: [self entryForHelper: helper ] ];
+    [_active removeObject: helper ];
+    [self admitHelpers];
+}
+
+- (void)removeAllHelpers
+{
+    for ( NSMutableArray *queue in _queues ) [queue removeAllObjects];
+    [_queued removeAllObjects];
+    for ( S3RequestHelper *helper in _active ) helper.borrowedRanges = 0;
+    [_active removeAllObjects];
+    _lentSlots = 0;
+    [self stopTimer];
+}
+
+- (void)admitHelpers
+{
+    // Starting a helper can finish it at once and call back in here, the outer loop picks up the freed slot instead.
+    if ( _admitting ) return;
+    _admitting = YES;
+
+    [self pruneActiveHelpers];
+    while ( [_queued count] > 0 && [_active count] < _maxActiveTransfers ) {
+
+        NSArray *entry = [self nextEntry];
+        S3RequestHelper *helper = [entry objectAtIndex: 0 ];
+        if ( helper.state != INITIALISED && helper.state != SUSPENDED ){
+            [self removeEntry: entry ];
+            continue;
+        }
+        if ( [_active count] > 0 && self.bytesInFlight + [self bytesRemainingForHelper: helper ] > _maxBytesInFlight ) break;
+
+        [self removeEntry: entry ];
+        [_active addObject: helper ];
+        [helper synchronise];
+        [self pruneActiveHelpers];
+    }
+    [self lendIdleSlots];
+    _admitting = NO;
+
+    if ( [_queued count] > 0 || _lentSlots > 0 ) [self startTimer];
+    else [self stopTimer];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Getters & Setters
+// ---------------------------------------------------------------------------------------------------------------------
+- (NSUInteger)maxActiveTransfers
+{
+    return _maxActiveTransfers;
+}
+
+- (void)setMaxActiveTransfers:(NSUInteger)maxActiveTransfers
+{
+    _maxActiveTransfers = MAX( maxActiveTransfers, 1 );
+    [self admitHelpers];
+}
+
+- (int64_t)maxBytesInFlight
+{
+    return _maxBytesInFlight;
+}
+
+- (void)setMaxBytesInFlight:(int64_t)maxBytesInFlight
+{
+    _maxBytesInFlight = MAX( maxBytesInFlight, 0 );
+    [self admitHelpers];
+}
+
+- (NSUInteger)activeCount   { return [_active count];   }
+- (NSArray*)activeHelpers   { return [_active copy];    }
+- (NSUInteger)queuedCount   { return [_queued count];   }
+
+- (int64_t)bytesInFlight
+{
+    int64_t bytes = 0;
+    for ( S3RequestHelper *helper in _active ) bytes += [self bytesRemainingForHelper: helper ];
+    return bytes;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Support Methods
+// ---------------------------------------------------------------------------------------------------------------------
+- (int64_t)bytesRemainingForHelper:(S3RequestHelper*)helper
+{
+    return MAX( helper.fileSize - helper.bytesTransferred, 0 );
+}
+
+// The head of each queue has waited longest in its class, so only the heads compete. A head is promoted one class for every
+// agingInterval it has waited, ties go to the helper that has waited longest.
+- (NSArray*)nextEntry
+{
+    NSTimeInterval now      = [NSDate timeIntervalSinceReferenceDate];
+    NSArray *best           = nil;
+    double bestPriority     = 0;
+
+    for ( NSUInteger priority = 0; priority < S3DH_PRIORITY_CLASSES; priority++ ) {
+        NSMutableArray *queue = [_queues objectAtIndex: priority ];
+        if ( [queue count] == 0 ) continue;
+
+        NSArray *entry = [queue objectAtIndex: 0 ];
+        NSTimeInterval queuedAt = [[entry objectAtIndex: 1 ] doubleValue];
+        double effective = priority + ( ( _agingInterval > 0 ) ? floor( ( now - queuedAt ) / _agingInterval ) : 0 );
+
+        if ( ! best || effective > bestPriority ||
+            ( effective == bestPriority && queuedAt < [[best objectAtIndex: 1 ] doubleValue] ) ){
+            best            = entry;
+            bestPriority    = effective;
+        }
+    }
+    return best;
+}
+
+- (NSArray*)entryForHelper:(S3RequestHelper*)helper
+{
+    for ( NSMutableArray *queue in _queues ) {
+        for ( NSArray *entry in queue ) {
+            if ( [entry objectAtIndex: 0 ] == helper ) return entry;
+        }
+    }
+    return nil;
+}
+
+- (void)removeEntry:(NSArray*)entry
+{
+    if ( ! entry ) return;
+
+    // Admitted entries are at the head of their queue, so the search stops at once.
+    NSMutableArray *queue = [_queues objectAtIndex: [[entry objectAtIndex: 2 ] unsignedIntegerValue] ];
+    NSUInteger index = [queue indexOfObjectIdenticalTo: entry ];
+    if ( index != NSNotFound ) [queue removeObjectAtIndex: index ];
+    [_queued removeObject: [entry objectAtIndex: 0 ] ];
+}
+
+// Helpers that finished, failed or suspended no longer hold a slot, and give back any they borrowed.
+- (void)pruneActiveHelpers
+{
+    for ( S3RequestHelper *helper in [_active copy] ) {
+        if ( helper.state != DOWNLOADING ){
+            helper.borrowedRanges = 0;
+            [_active removeObject: helper ];
+        }
+    }
+}
+
+// Shares the idle slots one at a time between the active helpers with the most left to request, largest first, so two large
+// objects finishing together split the slots between them. Nothing is lent while helpers are queued.
+- (void)lendIdleSlots
+{
+    NSUInteger idle = ( [_queued count] == 0 && [_active count] < _maxActiveTransfers ) ? _maxActiveTransfers - [_active count] : 0;
+
+    // Read each helper's unrequested bytes once, as helper and byte count pairs, rather than on both sides of every comparison.
+    NSMutableArray *candidates = [[NSMutableArray alloc] init];
+    for ( S3RequestHelper *helper in _active ) {
+        int64_t unrequested = helper.bytesUnrequested;
+        if ( unrequested >= S3DH_STEAL_MIN_BYTES ){
+            [candidates addObject: [NSArray arrayWithObjects: helper, [NSNumber numberWithLongLong: unrequested ], nil ] ];
+        }
+    }
+    [candidates sortUsingComparator:^NSComparisonResult( NSArray *a, NSArray *b ) {
+        return [[b objectAtIndex: 1 ] compare: [a objectAtIndex: 1 ] ];
+    }];
+    NSMutableArray *borrowers = [[NSMutableArray alloc] initWithCapacity: [candidates count] ];
+    for ( NSArray *candidate in candidates ) [borrowers addObject: [candidate objectAtIndex: 0 ] ];
+
+    NSMutableDictionary *loans = [[NSMutableDictionary alloc] init];
+    _lentSlots = ( [borrowers count] > 0 ) ? idle : 0;
+    for ( NSUInteger slot = 0; slot < _lentSlots; slot++ ) {
+        NSValue *borrower = [NSValue valueWithNonretainedObject: [borrowers objectAtIndex: slot % [borrowers count] ] ];
+        [loans setObject: [NSNumber numberWithUnsignedInteger: [[loans objectForKey: borrower ] unsignedIntegerValue] + 1 ] forKey: borrower ];
+    }
+
+    // Only touch helpers whose loan changed, setting a loan issues requests.
+    for ( S3RequestHelper *helper in _active ) {
+        NSUInteger slots    = [[loans objectForKey: [NSValue valueWithNonretainedObject: helper ] ] unsignedIntegerValue];
+        NSUInteger ranges   = slots * MAX( helper.parallelRanges, 1 );
+        if ( helper.borrowedRanges != ranges ) helper.borrowedRanges = ranges;
+    }
+}
+
+- (void)startTimer
+{
+    if ( _timer ) return;
+    __weak S3TransferScheduler *weakSelf = self;
+    _timer = [_engine scheduledTimerWithTimeInterval: S3DH_SCHEDULER_TICK repeats: YES block:^(NSTimer *timer) {
+        [weakSelf timerFired: timer ];
+    }];
+}
+
+- (void)stopTimer
+{
+    [_timer invalidate];
+    _timer = nil;
+}
+
+// Catches slots freed without a delegate callback, active helpers whose remaining bytes have fallen under the cap, and
+// borrowers that have run out of ranges to lend to.
+- (void)timerFired:(NSTimer*)timer
+{
+    [self admitHelpers];
+}
+
+@end
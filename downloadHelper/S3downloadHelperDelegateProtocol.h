@@ -8,6 +8,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class S3ProgressSnapshot;
+
 @protocol S3downloadHelperDelegateProtocol <NSObject>
 
 
@@ -24,6 +26,11 @@
 - (void)transferDidComplete;
 - (void)transferDidFail;
 
+/** Method called with the progress of every object in the bucket, at most S3DH_PROGRESS_RATE times a
+ second while objects are downloading and only when a byte count has changed.
+ */
+- (void)progressDidUpdate:(S3ProgressSnapshot*)snapshot;
+
 
 
 
@@ -7,6 +7,39 @@
 //
 
 #import "downloadHelperTests.h"
+#import "S3BlockMap.h"
+#import "S3BlockOutputStream.h"
+#import "S3FileWriter.h"
+#import "S3ObjectDigest.h"
+#import "S3BandwidthLimiter.h"
+#import "S3TransferEngine.h"
+#import "S3SyncManifest.h"
+#import "S3ListingDiff.h"
+#import "S3LatencyTracker.h"
+#import "S3RetryPolicy.h"
+#import "S3RequestHelper.h"
+#import <AWSS3/AmazonS3Client.h>
+
+#define TEST_LARGE_OBJECT_SIZE  6442450944LL    // 6 GB, past both the 32 bit signed and unsigned limits.
+#define TEST_BLOCK_SIZE         262144
+
+// Request helper delegate that keeps its files in a temporary folder and never downloads.
+@interface downloadHelperTestsDelegate : NSObject <S3RequestHelperDelegateProtocol>
+@property (nonatomic, strong) NSString *folder;
+@end
+
+@implementation downloadHelperTestsDelegate
+@synthesize folder = _folder;
+- (BOOL)downloadEnable                                  { return false; }
+- (NSString*)downloadPath:(S3RequestHelper*)s3rh        { return [_folder stringByAppendingPathComponent: @"object.tmp"]; }
+- (NSString*)persistPath:(S3RequestHelper*)s3rh         { return [_folder stringByAppendingPathComponent: @"object"]; }
+- (BOOL)validateMD5forDownload:(S3RequestHelper*)s3rh   { return false; }
+- (BOOL)validateMD5forPersist:(S3RequestHelper*)s3rh    { return false; }
+- (void)downloadFinished:(S3RequestHelper*)s3rh         {}
+- (BOOL)persistFile:(S3RequestHelper*)s3rh              { return false; }
+- (BOOL)deleteFile:(S3RequestHelper*)s3rh               { return false; }
+- (void)downloadFailed:(S3RequestHelper*)s3rh           {}
+@end
 
 @implementation downloadHelperTests
 
@@ -29,4 +62,286 @@
     STFail(@"Unit tests are not implemented yet in downloadHelperTests");
 }
 
+// Maps a 6 GB object and checks the offsets of blocks past 4 GB, and that a zero byte object has no blocks to fetch.
+- (void)testLargeObjectBlockMap
+{
+    S3BlockMap *map = [[S3BlockMap alloc] initWithLength: TEST_LARGE_OBJECT_SIZE blockSize: TEST_BLOCK_SIZE ];
+    NSUInteger last = map.blockCount - 1;
+
+    STAssertEquals( map.blockCount, (NSUInteger)( TEST_LARGE_OBJECT_SIZE / TEST_BLOCK_SIZE ), @"Block count" );
+    STAssertEquals( [map offsetOfBlock: last], TEST_LARGE_OBJECT_SIZE - TEST_BLOCK_SIZE, @"Offset of the final block" );
+    STAssertEquals( [map lengthOfBlocks: NSMakeRange( last, 1 )], (int64_t)TEST_BLOCK_SIZE, @"Length of the final block" );
+
+    [map completeBlocks: NSMakeRange( last, 1 ) ];
+    STAssertEquals( map.completedLength, (int64_t)TEST_BLOCK_SIZE, @"Completed length" );
+    STAssertEquals( map.committedLength, (int64_t)0, @"Nothing committed before the gap fills" );
+
+    S3BlockMap *empty = [[S3BlockMap alloc] initWithLength: 0 blockSize: TEST_BLOCK_SIZE ];
+    STAssertTrue( empty.isComplete, @"A zero byte object is complete" );
+    STAssertEquals( [empty requestBlocks: 1].location, (NSUInteger)NSNotFound, @"A zero byte object has no blocks" );
+}
+
+// Claims ranges in order, stops a claim at a completed block, requests a released range again and keeps the counts in step.
+- (void)testBlockMapClaimsAndCounts
+{
+    S3BlockMap *map = [[S3BlockMap alloc] initWithLength: 10 * TEST_BLOCK_SIZE blockSize: TEST_BLOCK_SIZE ];
+    [map completeBlocks: NSMakeRange( 6, 1 ) ];
+
+    STAssertEquals( [map requestBlocks: 4 ], NSMakeRange( 0, 4 ), @"First claim from the start" );
+    STAssertEquals( [map requestBlocks: 4 ], NSMakeRange( 4, 2 ), @"Claim stops at the completed block" );
+    STAssertEquals( [map requestBlocks: 4 ], NSMakeRange( 7, 3 ), @"Claim skips the completed block" );
+    STAssertEquals( map.unrequestedBlocks, (NSUInteger)0, @"Every block claimed" );
+
+    [map releaseBlocks: NSMakeRange( 0, 4 ) ];
+    [map completeBlocks: NSMakeRange( 4, 2 ) ];
+    STAssertEquals( map.unrequestedBlocks, (NSUInteger)4, @"Released blocks unrequested" );
+    STAssertEquals( map.completedBlocks, (NSUInteger)3, @"Completed blocks counted once" );
+    STAssertEquals( [map requestBlocks: 8 ], NSMakeRange( 0, 4 ), @"Released range claimed again" );
+    STAssertEquals( [map requestBlocks: 8 ].location, (NSUInteger)NSNotFound, @"Nothing left to claim" );
+}
+
+// Builds a helper from the listing of a 6 GB object, the whole length is mapped and the object is fetched in blocks.
+- (void)testLargeObjectRequestHelper
+{
+    downloadHelperTestsDelegate *delegate = [[downloadHelperTestsDelegate alloc] init];
+    delegate.folder = [NSTemporaryDirectory() stringByAppendingPathComponent: [[NSProcessInfo processInfo] globallyUniqueString] ];
+
+    S3ObjectSummary *summary = [[S3ObjectSummary alloc] init];
+    summary.key     = @"object";
+    summary.etag    = @"\"d41d8cd98f00b204e9800998ecf8427e\"";
+    summary.size    = (NSInteger)TEST_LARGE_OBJECT_SIZE;
+
+    AmazonS3Client *client  = [[AmazonS3Client alloc] initWithAccessKey: @"key" withSecretKey: @"secret" ];
+    S3RequestHelper *helper = [[S3RequestHelper alloc] initWithS3ObjectSummary: summary S3Client: client bucket: @"bucket"
+                                                                       delegate: delegate error: nil ];
+    if( sizeof( NSInteger ) >= sizeof( int64_t ) ){
+        STAssertEquals( helper.fileSize, TEST_LARGE_OBJECT_SIZE, @"Listed size kept whole" );
+        STAssertEquals( helper.bytesUnrequested, TEST_LARGE_OBJECT_SIZE, @"Every block past 4 GB mapped" );
+    }
+    else{
+        // The listing is truncated to 32 bits, the first response supplies the rest.
+        STAssertEquals( (uint32_t)helper.fileSize, (uint32_t)TEST_LARGE_OBJECT_SIZE, @"Truncated size read back unsigned" );
+        STAssertTrue( helper.fileSize >= 0, @"Truncated size never negative" );
+    }
+    STAssertEquals( helper.state, INITIALISED, @"Nothing on disk to check" );
+
+    [[NSFileManager defaultManager] removeItemAtPath: delegate.folder error: nil ];
+}
+
+// Streams the final block of a 6 GB object into a sparse file through a block stream, with memory bounded to one block.
+- (void)testLargeObjectBlockStream
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent: @"downloadHelperTests.large"];
+    S3FileWriter *writer = [[S3FileWriter alloc] initWithPath: path truncate: YES error: nil ];
+    STAssertNotNil( writer, @"Writer opened" );
+    STAssertTrue( [writer truncateToLength: TEST_LARGE_OBJECT_SIZE], @"Sparse file sized" );
+
+    int64_t offset = TEST_LARGE_OBJECT_SIZE - TEST_BLOCK_SIZE;
+    S3BlockOutputStream *stream = [[S3BlockOutputStream alloc] initWithFileWriter: writer offset: offset length: TEST_BLOCK_SIZE ];
+    [stream open];
+
+    uint8_t chunk[4096];
+    for( NSUInteger i = 0; i < TEST_BLOCK_SIZE / sizeof(chunk); i++ ){
+        memset( chunk, (int)( i & 0xff ), sizeof(chunk) );
+        STAssertEquals( [stream write: chunk maxLength: sizeof(chunk)], (NSInteger)sizeof(chunk), @"Chunk accepted" );
+    }
+    STAssertEquals( [stream write: chunk maxLength: sizeof(chunk)], (NSInteger)0, @"Nothing accepted past the block end" );
+    [stream close];
+
+    uint8_t byte = 0;
+    STAssertEquals( pread( writer.fileDescriptor, &byte, 1, (off_t)( TEST_LARGE_OBJECT_SIZE - 1 ) ), (ssize_t)1, @"Final byte read" );
+    STAssertEquals( byte, (uint8_t)( ( TEST_BLOCK_SIZE / sizeof(chunk) - 1 ) & 0xff ), @"Final byte written at a 64 bit offset" );
+
+    [writer close];
+    [[NSFileManager defaultManager] removeItemAtPath: path error: nil ];
+}
+
+// Continues a digest restored at an offset past 4 GB, only the bytes beyond the hashed offset are used.
+- (void)testLargeObjectDigestOffsets
+{
+    NSMutableDictionary *state = [[[[S3ObjectDigest alloc] init] state] mutableCopy];
+    [state setObject: [NSNumber numberWithLongLong: TEST_LARGE_OBJECT_SIZE - 10] forKey: @"offset"];
+
+    S3ObjectDigest *digest = [[S3ObjectDigest alloc] initWithState: state ];
+    uint8_t bytes[20] = { 0 };
+    STAssertEquals( [digest updateWithBytes: bytes length: sizeof(bytes) atOffset: TEST_LARGE_OBJECT_SIZE - 20], (NSUInteger)10, @"Overlap skipped" );
+    STAssertEquals( digest.hashedOffset, TEST_LARGE_OBJECT_SIZE, @"Hashed to the end of the object" );
+    STAssertEquals( [digest updateWithBytes: bytes length: sizeof(bytes) atOffset: TEST_LARGE_OBJECT_SIZE + 10], (NSUInteger)0, @"Gap not hashed" );
+}
+
+// A multipart ETag with more parts than the object has bytes fits no part size, and must not fall back to a plain MD5.
+- (void)testUnverifiableMultipartDigest
+{
+    S3ObjectDigest *digest = [[S3ObjectDigest alloc] initWithETag: @"d41d8cd98f00b204e9800998ecf8427e-3" length: 2 partSize: 0 ];
+    uint8_t bytes[2] = { 0 };
+    [digest updateWithBytes: bytes length: sizeof(bytes) atOffset: 0 ];
+    STAssertFalse( digest.isVerifiable, @"No part size fits" );
+    STAssertEqualObjects( [digest digestForETag: @"d41d8cd98f00b204e9800998ecf8427e-3"], S3DH_DIGEST_UNVERIFIABLE, @"Reported as unverifiable" );
+    STAssertFalse( [[[S3ObjectDigest alloc] initWithState: digest.state ] isVerifiable], @"Survives a checkpoint" );
+}
+
+// Grants reservations the bucket covers at once and queues the rest, a reservation larger than the burst waits for a full bucket.
+- (void)testBandwidthLimiterReservations
+{
+    S3BandwidthLimiter *limiter = [[S3BandwidthLimiter alloc] initWithRate: 1000 burst: 1000 engine: [S3TransferEngine sharedEngine] ];
+    __block NSUInteger granted = 0;
+
+    [limiter reserveBytes: 600 completion:^{ granted++; } ];
+    STAssertEquals( granted, (NSUInteger)1, @"Covered by the full bucket" );
+
+    [limiter reserveBytes: 5000 completion:^{ granted++; } ];
+    [limiter reserveBytes: 1 completion:^{ granted++; } ];
+    STAssertEquals( granted, (NSUInteger)1, @"Waits for the bucket to refill" );
+    STAssertEquals( limiter.waitingCount, (NSUInteger)2, @"Later reservations queue behind the first" );
+    STAssertEquals( limiter.bytesReserved, (int64_t)600, @"Only granted bytes counted" );
+}
+
+// Drops waiting reservations without granting them and refunds the unused part of a granted one.
+- (void)testBandwidthLimiterCancellation
+{
+    S3BandwidthLimiter *limiter = [[S3BandwidthLimiter alloc] initWithRate: 1000 burst: 1000 engine: [S3TransferEngine sharedEngine] ];
+    __block NSUInteger granted = 0;
+
+    S3BandwidthReservation *first   = [limiter reserveBytes: 600 completion:^{ granted++; } ];
+    S3BandwidthReservation *large   = [limiter reserveBytes: 5000 completion:^{ granted++; } ];
+    S3BandwidthReservation *small   = [limiter reserveBytes: 1 completion:^{ granted++; } ];
+    STAssertTrue( first.isGranted, @"Covered by the full bucket" );
+
+    [limiter cancelReservation: small usedBytes: 0 ];
+    STAssertEquals( limiter.waitingCount, (NSUInteger)1, @"Waiting reservation dropped" );
+
+    [limiter cancelReservation: first usedBytes: 100 ];
+    STAssertEquals( limiter.bytesReserved, (int64_t)100, @"Unused bytes refunded" );
+    STAssertFalse( large.isGranted, @"Refund does not fill the bucket past the burst" );
+
+    [limiter cancelReservation: large usedBytes: 0 ];
+    [limiter cancelReservation: large usedBytes: 0 ];
+    STAssertEquals( limiter.waitingCount, (NSUInteger)0, @"Queue empty" );
+    STAssertEquals( granted, (NSUInteger)1, @"Cancelled reservations never granted" );
+
+    [limiter reserveBytes: 900 completion:^{ granted++; } ];
+    STAssertEquals( granted, (NSUInteger)2, @"Refunded tokens available at once" );
+}
+
+// Compares a block with blocks of its own size class, scales the time per byte until the class has samples, and caps hedges
+// across every request counted by the tracker.
+- (void)testLatencyTrackerSizeClassesAndHedges
+{
+    S3LatencyTracker *tracker = [[S3LatencyTracker alloc] init];
+    for( NSUInteger i = 0; i < S3DH_LATENCY_MIN_SAMPLES; i++ ) [tracker recordDuration: 1.0 forLength: 1048576 ];
+
+    STAssertEqualsWithAccuracy( [tracker percentile: 0.95 forLength: 1048576 ], 1.0, 0.001, @"Same size class" );
+    STAssertEqualsWithAccuracy( [tracker percentile: 0.95 forLength: 262144 ], 0.25, 0.001, @"Scaled per byte" );
+
+    for( NSUInteger i = 0; i < 19; i++ ) [tracker recordRequest];
+    STAssertFalse( [tracker acquireHedge], @"One hedge needs twenty requests" );
+    [tracker recordRequest];
+    STAssertTrue( [tracker acquireHedge], @"Allowance reached" );
+    STAssertFalse( [tracker acquireHedge], @"Allowance spent" );
+    for( NSUInteger i = 0; i < 20; i++ ) [tracker recordRequest];
+    STAssertTrue( [tracker acquireHedge], @"Requests of any helper add to the allowance" );
+}
+
+// Empties the retry budget, retries past it wait for the refill instead of failing and stop waiting once it has recovered.
+- (void)testRetryBudgetWaitsForRefill
+{
+    S3RetryPolicy *policy = [[S3RetryPolicy alloc] initWithBaseDelay: 0 maxDelay: 0 budget: 2 refillRate: 10.0 ];
+    STAssertEqualsWithAccuracy( [policy delayForRetry: 1 ], 0.0, 0.001, @"Budget covers the first retry" );
+    STAssertEqualsWithAccuracy( [policy delayForRetry: 1 ], 0.0, 0.001, @"Budget covers the second retry" );
+    STAssertEqualsWithAccuracy( [policy delayForRetry: 1 ], 0.1, 0.01, @"Empty budget waits for one refill" );
+    STAssertEqualsWithAccuracy( [policy delayForRetry: 1 ], 0.2, 0.01, @"Waits queue behind each other" );
+    STAssertEquals( policy.waits, (NSUInteger)2, @"Waiting retries counted" );
+
+    [NSThread sleepForTimeInterval: 0.3 ];
+    STAssertTrue( policy.availableRetries >= 1.0, @"Budget refilled past the waiting retries" );
+    STAssertEqualsWithAccuracy( [policy delayForRetry: 1 ], 0.0, 0.001, @"Recovered budget retries at once" );
+    STAssertEquals( policy.retries, (NSUInteger)5, @"Every retry granted" );
+}
+
+// Saves an entry, reloads the manifest from disk and checks the entry still matches its file until the file is rewritten.
+- (void)testSyncManifestRoundTrip
+{
+    NSString *folder    = [NSTemporaryDirectory() stringByAppendingPathComponent: [[NSProcessInfo processInfo] globallyUniqueString] ];
+    NSString *filePath  = [folder stringByAppendingPathComponent: @"object.dat"];
+    NSString *path      = [folder stringByAppendingPathComponent: @"bucket.manifest"];
+    [[NSFileManager defaultManager] createDirectoryAtPath: folder withIntermediateDirectories: YES attributes: nil error: nil ];
+    [[NSData dataWithBytes: "manifest" length: 8 ] writeToFile: filePath atomically: NO ];
+
+    S3SyncManifest *manifest = [[S3SyncManifest alloc] initWithPath: path engine: [S3TransferEngine sharedEngine] ];
+    [manifest setEntry: [[S3ManifestEntry alloc] initWithETag: @"etag" lastModified: nil filePath: filePath verified: YES ] forKey: @"key" ];
+    STAssertTrue( [manifest save], @"Manifest written" );
+
+    S3ManifestEntry *entry = [[[S3SyncManifest alloc] initWithPath: path engine: [S3TransferEngine sharedEngine] ] entryForKey: @"key" ];
+    STAssertEqualObjects( entry.etag, @"etag", @"Entry reloaded" );
+    STAssertEquals( entry.size, (int64_t)8, @"Size recorded" );
+    STAssertTrue( [entry matchesFileAtPath: filePath ], @"Unchanged file matches" );
+
+    [[NSData dataWithBytes: "replaced" length: 8 ] writeToFile: filePath atomically: YES ];
+    STAssertFalse( [entry matchesFileAtPath: filePath ], @"Replaced file is suspect" );
+
+    [[NSFileManager defaultManager] removeItemAtPath: folder error: nil ];
+}
+
+- (S3ObjectSummary*)summaryWithKey:(NSString*)key etag:(NSString*)etag
+{
+    S3ObjectSummary *summary = [[S3ObjectSummary alloc] init];
+    summary.key     = key;
+    summary.etag    = etag;
+    summary.size    = 1;
+    return summary;
+}
+
+// Walks a previous listing alongside two new pages and checks each key is reported once, in key order, with its change.
+- (void)testListingDiffMergeJoin
+{
+    NSArray *previous = [NSArray arrayWithObjects: [self summaryWithKey: @"a" etag: @"1"], [self summaryWithKey: @"b" etag: @"1"],
+                         [self summaryWithKey: @"d" etag: @"1"], [self summaryWithKey: @"f" etag: @"1"], nil ];
+
+    NSMutableArray *events = [[NSMutableArray alloc] init];
+    S3ListingDiff *diff = [[S3ListingDiff alloc] initWithSummaries: previous handler:^(S3DH_KEY_DIFF change, S3ObjectSummary *summary) {
+        [events addObject: [NSString stringWithFormat: @"%d%@", change, summary.key ] ];
+    }];
+
+    [diff diffPage: [NSArray arrayWithObjects: [self summaryWithKey: @"a" etag: @"1"], [self summaryWithKey: @"c" etag: @"1"], nil ] ];
+    [diff diffPage: [NSArray arrayWithObjects: [self summaryWithKey: @"d" etag: @"2"], [self summaryWithKey: @"e" etag: @"1"], nil ] ];
+    STAssertEquals( [diff.summaries count], (NSUInteger)5, @"Unreached keys kept until the listing finishes" );
+
+    [diff finish];
+    NSArray *expected = [NSArray arrayWithObjects:
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_UNCHANGED, @"a" ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_REMOVED,   @"b" ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_ADDED,     @"c" ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_CHANGED,   @"d" ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_ADDED,     @"e" ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_REMOVED,   @"f" ], nil ];
+    STAssertEqualObjects( events, expected, @"Each key reported once in key order" );
+    STAssertEquals( [diff.summaries count], (NSUInteger)4, @"New listing replaces the previous one" );
+}
+
+// Keys outside the basic plane sort after U+FF61 by their UTF-8 bytes, as S3 lists them, but before it by UTF-16 code units. A
+// diff that ordered keys like compare: would report both keys of an unchanged listing as removed and added again.
+- (void)testListingDiffUTF8KeyOrder
+{
+    NSString *halfwidth = @"x\uFF61";
+    NSString *emoji     = @"x\U0001F600";
+    STAssertEquals( [S3ListingDiff compareKey: halfwidth toKey: emoji ], NSOrderedAscending, @"UTF-8 byte order" );
+    STAssertEquals( [halfwidth compare: emoji options: NSLiteralSearch ], NSOrderedDescending, @"UTF-16 order differs" );
+
+    NSArray *listing = [S3ListingDiff sortedSummaries: [NSArray arrayWithObjects: [self summaryWithKey: emoji etag: @"1"],
+                                                        [self summaryWithKey: halfwidth etag: @"1"], nil ] ];
+    STAssertEqualObjects( [[listing objectAtIndex: 0 ] key], halfwidth, @"Sorted in S3 key order" );
+
+    NSMutableArray *events = [[NSMutableArray alloc] init];
+    S3ListingDiff *diff = [[S3ListingDiff alloc] initWithSummaries: listing handler:^(S3DH_KEY_DIFF change, S3ObjectSummary *summary) {
+        [events addObject: [NSString stringWithFormat: @"%d%@", change, summary.key ] ];
+    }];
+    [diff diffPage: [NSArray arrayWithObjects: [self summaryWithKey: halfwidth etag: @"1"], [self summaryWithKey: emoji etag: @"1"], nil ] ];
+    [diff finish];
+
+    NSArray *expected = [NSArray arrayWithObjects:
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_UNCHANGED, halfwidth ],
+                         [NSString stringWithFormat: @"%d%@", S3DH_KEY_UNCHANGED, emoji ], nil ];
+    STAssertEqualObjects( events, expected, @"Unchanged keys matched across the orders" );
+}
+
 @end